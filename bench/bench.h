@@ -0,0 +1,55 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "jd_protocol.h"
+#include "jd_sim.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+// not a real service class; only used between bench_*.c and bench_app.c
+#define BENCH_SERVICE_CLASS 0x1bec0c1a
+// payload: seq, send time (low 32 bits of the simulated clock), padding
+#define BENCH_CMD_PING 0x80
+
+// device identifier of n-th simulated node in multi-node benchmarks
+#define BENCH_DEVICE_ID(n) (0x4242000000000000ULL + (n))
+
+// jd_sim_probe() kinds
+#define BENCH_PROBE_DISPATCH 1    // a = seq, b = latency in us, from start of the frame
+#define BENCH_PROBE_REPORT 2      // a = sender node, b = latency in us, from jd_send()
+#define BENCH_PROBE_REPORT_SENT 3 // a = 1 if queued, 0 if jd_send() failed, b = us late
+
+void bench_service_init(void);
+// makes the bench service stream readings of 'size' bytes every 'interval_us';
+// has to be called before jd_posix_start()
+void bench_set_report(uint32_t interval_us, uint32_t size);
+// build readings on the stack and jd_send() them, instead of jd_send_reserve()
+void bench_set_report_copy(int copy);
+// number of bench services on the device (default 1); the n-th one has service class
+// BENCH_SERVICE_CLASS + n; has to be called before jd_posix_start()
+#define BENCH_MAX_SERVICES 31
+void bench_set_num_services(uint32_t n);
+// can be defined by a benchmark to add its own services, after the bench services
+void bench_init_services(void);
+
+static inline int bench_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// sorts 'v' in place
+static inline uint32_t bench_percentile(uint32_t *v, uint32_t n, unsigned pct) {
+    if (!n)
+        return 0;
+    qsort(v, n, sizeof(uint32_t), bench_cmp_u32);
+    return v[(n - 1) * pct / 100];
+}
+
+static inline uint64_t bench_wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
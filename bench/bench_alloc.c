@@ -0,0 +1,174 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Allocator stress test: after some allocations that are never freed (like service states and
+ * queues at boot), objects of random sizes are allocated and freed, keeping the live data at
+ * around -o percent of the heap. Most objects are small (like speech phrases), some mid-sized,
+ * a few large (like pixel buffers, up to -m bytes).
+ * Every object is filled with a pattern, which is checked when it's freed.
+ * Reports the time per jd_alloc()/jd_free() and the fragmentation (jd_alloc_get_stats()).
+ * Only needs source/interfaces/pool_alloc.c, built with JD_POOL_HEAP_SIZE.
+ */
+
+#include "bench.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+
+#define MAX_OBJECTS 4096
+
+static struct {
+    uint8_t *ptr;
+    uint32_t size;
+} objs[MAX_OBJECTS];
+static uint32_t num_objs;
+// bytes asked for by live objects, and the iteration; printed when running out of memory
+static uint32_t live, it;
+
+static jmp_buf out_of_memory;
+
+void jd_panic(void) {
+    longjmp(out_of_memory, 1);
+}
+
+static uint32_t rnd(uint32_t lo, uint32_t hi) {
+    return lo + (uint32_t)rand() % (hi - lo + 1);
+}
+
+static uint32_t object_size(uint32_t max_size) {
+    uint32_t r = rnd(0, 99);
+    if (r < 70)
+        return rnd(1, 64);
+    if (r < 95)
+        return rnd(65, 252);
+    return rnd(253, max_size);
+}
+
+static int check(uint32_t i) {
+    for (uint32_t k = 0; k < objs[i].size; ++k)
+        if (objs[i].ptr[k] != (uint8_t)(objs[i].size + k)) {
+            fprintf(stderr, "object of %u bytes at %p corrupted\n", objs[i].size, objs[i].ptr);
+            return -1;
+        }
+    return 0;
+}
+
+static uint8_t *alloc(uint32_t size, uint32_t *t, uint32_t *num_t) {
+    uint64_t t0 = bench_wall_ns();
+    uint8_t *p = jd_alloc(size);
+    t[(*num_t)++] = bench_wall_ns() - t0;
+    for (uint32_t k = 0; k < size; ++k) {
+        if (p[k] != 0) {
+            fprintf(stderr, "jd_alloc() returned memory that is not zeroed\n");
+            exit(1);
+        }
+        p[k] = size + k;
+    }
+    return p;
+}
+
+static void print_stats(const char *label) {
+    jd_alloc_stats_t *st = jd_alloc_get_stats();
+    printf("%s in use %u, in blocks %u, in free lists %u, never used %u (max in use %u)\n", label,
+           st->in_use, st->in_blocks, st->in_free_lists, st->never_used, st->max_in_use);
+    printf("%*s internal fragmentation %.1f%%, external %.1f%%\n", (int)strlen(label), "",
+           st->in_blocks ? 100.0 * (st->in_blocks - st->in_use) / st->in_blocks : 0.0,
+           100.0 * st->in_free_lists / (st->in_free_lists + st->never_used));
+}
+
+int main(int argc, char **argv) {
+    uint32_t iters = 1000000;
+    uint32_t occupancy = 50;
+    uint32_t max_size = 1024;
+    uint32_t boot_bytes = 2048;
+    uint32_t seed = 1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        uint32_t v = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-n"))
+            iters = v;
+        else if (!strcmp(argv[i], "-o"))
+            occupancy = v;
+        else if (!strcmp(argv[i], "-m"))
+            max_size = v;
+        else if (!strcmp(argv[i], "-b"))
+            boot_bytes = v;
+        else if (!strcmp(argv[i], "-s"))
+            seed = v;
+        else {
+            fprintf(stderr,
+                    "usage: %s [-n iterations] [-o occupancy_pct] [-m max_size] [-b boot_bytes] "
+                    "[-s seed]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (max_size < 253 || occupancy > 100) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+
+    uint32_t *t_alloc = calloc(iters + boot_bytes / 8 + 1, sizeof(uint32_t));
+    uint32_t *t_free = calloc(iters, sizeof(uint32_t));
+    uint32_t num_alloc = 0, num_free = 0;
+    uint64_t total_bytes = 0;
+
+    srand(seed);
+    jd_alloc_init();
+    uint32_t heap_size = jd_alloc_get_stats()->heap_size;
+    uint32_t target = (uint64_t)heap_size * occupancy / 100;
+
+    if (setjmp(out_of_memory)) {
+        printf("out of memory after %u iterations, with %u bytes live (%.1f%% of the heap), "
+               "asking for %u\n",
+               it, live, 100.0 * live / heap_size, objs[num_objs].size);
+        print_stats("at that point:");
+        return 1;
+    }
+
+    // never freed
+    for (uint32_t b = 0; b < boot_bytes;) {
+        uint32_t size = rnd(8, 200);
+        objs[num_objs].size = size;
+        alloc(size, t_alloc, &num_alloc);
+        b += size;
+        live += size;
+    }
+    num_alloc = 0;
+    uint32_t boot_live = live;
+
+    for (it = 0; it < iters; ++it) {
+        if (num_objs < MAX_OBJECTS && (num_objs == 0 || live < target) && rand() % 4 != 0) {
+            uint32_t size = object_size(max_size);
+            if (live + size > target && num_objs)
+                continue;
+            objs[num_objs].size = size;
+            objs[num_objs].ptr = alloc(size, t_alloc, &num_alloc);
+            live += size;
+            total_bytes += size;
+            num_objs++;
+        } else if (num_objs) {
+            uint32_t i = rnd(0, num_objs - 1);
+            if (check(i))
+                return 1;
+            uint64_t t0 = bench_wall_ns();
+            jd_free(objs[i].ptr);
+            t_free[num_free++] = bench_wall_ns() - t0;
+            live -= objs[i].size;
+            objs[i] = objs[--num_objs];
+        }
+    }
+
+    printf("%u byte heap, %u bytes at boot, live data kept under %u%% of the heap\n", heap_size,
+           boot_live, occupancy);
+    printf("allocations:      %u (%llu bytes; a bump allocator would need them all)\n",
+           num_alloc, (unsigned long long)total_bytes);
+    printf("jd_alloc():       p50 %uns p99 %uns max %uns\n", bench_percentile(t_alloc, num_alloc, 50),
+           bench_percentile(t_alloc, num_alloc, 99), bench_percentile(t_alloc, num_alloc, 100));
+    printf("jd_free():        p50 %uns p99 %uns max %uns\n", bench_percentile(t_free, num_free, 50),
+           bench_percentile(t_free, num_free, 99), bench_percentile(t_free, num_free, 100));
+    print_stats("at the end:");
+    free(t_alloc);
+    free(t_free);
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Announce request storm, as after a bus reset, when every client asks all devices for their
+ * services (JD_CONTROL_CMD_SERVICES broadcast to the control service class).
+ * Measures how soon the device answers, and the CPU it spends per request.
+ * Build once with JD_CONFIG_ANNOUNCE_IRQ=0 and once with =1 to compare.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+#define DUT_ID 0x1122334455667788ULL
+
+static uint64_t req_end;
+static int pending;
+static uint32_t *latency, num_latency;
+
+static void monitor(int node, const uint8_t *data, uint32_t len, uint64_t start, uint64_t end,
+                    int collided) {
+    if (collided)
+        return;
+    if (node == JD_SIM_NODE_EXTERNAL) {
+        req_end = end;
+        pending = 1;
+        return;
+    }
+    if (node != 0 || !pending || start < req_end)
+        return;
+    jd_frame_t frame;
+    memcpy(&frame, data, len);
+    for (;;) {
+        jd_packet_t *pkt = (jd_packet_t *)&frame;
+        if (pkt->service_index == JD_SERVICE_INDEX_CONTROL &&
+            pkt->service_command == JD_CONTROL_CMD_SERVICES) {
+            latency[num_latency++] = start - req_end;
+            pending = 0;
+            break;
+        }
+        if (!jd_shift_frame(&frame))
+            break;
+    }
+}
+
+int main(int argc, char **argv) {
+    uint32_t iters = 10000;
+    uint32_t period_us = 2000;
+    uint32_t num_services = 8;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        uint32_t v = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-n"))
+            iters = v;
+        else if (!strcmp(argv[i], "-p"))
+            period_us = v;
+        else if (!strcmp(argv[i], "-S"))
+            num_services = v;
+        else if (!strcmp(argv[i], "-L"))
+            jd_sim_config.loop_us = v;
+        else {
+            fprintf(stderr, "usage: %s [-n requests] [-p period_us] [-S services] [-L loop_us]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    latency = calloc(iters, sizeof(uint32_t));
+    bench_set_num_services(num_services);
+    jd_sim_reset();
+    jd_sim_set_monitor(monitor);
+    jd_posix_start(DUT_ID);
+    jd_sim_run_until(100000);
+
+    jd_frame_t frame;
+    jd_reset_frame(&frame);
+    frame.flags = JD_FRAME_FLAG_COMMAND | JD_FRAME_FLAG_IDENTIFIER_IS_SERVICE_CLASS;
+    frame.device_identifier = JD_SERVICE_CLASS_CONTROL;
+    jd_push_in_frame(&frame, JD_SERVICE_INDEX_CONTROL, JD_CONTROL_CMD_SERVICES, 0);
+    jd_compute_crc(&frame);
+
+    jd_sim_node_stats_t st0 = *jd_sim_node_stats(0);
+    uint64_t t = jd_sim_now();
+    uint32_t sent = 0;
+    while (sent < iters) {
+        if (jd_sim_inject(&frame, JD_FRAME_SIZE(&frame)) == 0)
+            sent++;
+        t += period_us;
+        jd_sim_run_until(t);
+    }
+    jd_sim_run_until(t + 100000);
+    jd_sim_node_stats_t *st = jd_sim_node_stats(0);
+
+    uint32_t n = num_latency;
+    printf("%u services, %u requests every %uus, %s\n", num_services + 1, sent, period_us,
+           JD_CONFIG_ANNOUNCE_IRQ ? "answered in IRQ" : "answered in main loop");
+    printf("answered:         %u\n", n);
+    printf("response latency: p50 %uus p99 %uus max %uus\n", bench_percentile(latency, n, 50),
+           bench_percentile(latency, n, 99), bench_percentile(latency, n, 100));
+    printf("cpu per request:  %.0fns (IRQ %.0fns)\n",
+           (double)(st->cpu_ns_irq + st->cpu_ns_loop - st0.cpu_ns_irq - st0.cpu_ns_loop) / sent,
+           (double)(st->cpu_ns_irq - st0.cpu_ns_irq) / sent);
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Application linked into every simulated node: a service answering pings and registers,
+ * and optionally streaming readings (payload: seq, time of jd_send(), padding).
+ * There can be several copies of the service, with different service classes.
+ */
+
+#include "bench.h"
+
+const char app_dev_class_name[] = "jacdac-c host benchmark";
+const char app_fw_version[] = "v0.0.0";
+
+static uint32_t report_interval, report_size;
+static uint8_t report_copy;
+static uint32_t num_bench_services = 1;
+
+struct srv_state {
+    SRV_COMMON;
+    uint8_t intensity;
+    uint32_t value;
+    uint32_t streaming_interval;
+    uint32_t next_report;
+    uint32_t report_seq;
+};
+
+REG_DEFINITION(                         //
+    bench_regs,                         //
+    REG_SRV_COMMON,                     //
+    REG_U8(JD_REG_INTENSITY),           //
+    REG_U32(JD_REG_VALUE),              //
+    REG_U32(JD_REG_STREAMING_INTERVAL), //
+);
+
+void bench_set_report(uint32_t interval_us, uint32_t size) {
+    report_interval = interval_us;
+    report_size = size < 8 ? 8 : size > JD_SERIAL_PAYLOAD_SIZE ? JD_SERIAL_PAYLOAD_SIZE : size;
+}
+
+void bench_set_report_copy(int copy) {
+    report_copy = copy;
+}
+
+void bench_set_num_services(uint32_t n) {
+    num_bench_services = n < 1 ? 1 : n > BENCH_MAX_SERVICES ? BENCH_MAX_SERVICES : n;
+}
+
+void bench_process(srv_t *state) {
+    uint32_t due = state->next_report;
+    if (report_interval && jd_should_sample(&state->next_report, report_interval)) {
+        if (report_copy) {
+            uint32_t buf[JD_SERIAL_PAYLOAD_SIZE / 4] = {state->report_seq++, now};
+            int r = jd_send(state->service_index, JD_GET(JD_REG_READING), buf, report_size);
+            jd_sim_probe(BENCH_PROBE_REPORT_SENT, r == 0, now - due);
+            jd_services_wake_at(state, state->next_report);
+            return;
+        }
+        uint32_t *dst = jd_send_reserve(state->service_index, JD_GET(JD_REG_READING), report_size);
+        if (dst) {
+            memset(dst, 0, report_size);
+            dst[0] = state->report_seq++;
+            dst[1] = now;
+            jd_send_commit();
+        }
+        jd_sim_probe(BENCH_PROBE_REPORT_SENT, dst != NULL, now - due);
+    }
+    if (report_interval)
+        jd_services_wake_at(state, state->next_report);
+    else
+        jd_services_wake_on_packet(state);
+}
+
+void bench_handle_packet(srv_t *state, jd_packet_t *pkt) {
+    if (pkt->service_command == BENCH_CMD_PING && pkt->service_size >= 8) {
+        uint32_t *d = (uint32_t *)pkt->data;
+        jd_sim_probe(BENCH_PROBE_DISPATCH, d[0], now - d[1]);
+        jd_send(pkt->service_index, BENCH_CMD_PING, pkt->data, pkt->service_size);
+        return;
+    }
+    service_handle_register_final(state, pkt, bench_regs);
+}
+
+SRV_DEF(bench, BENCH_SERVICE_CLASS);
+void bench_service_init(void) {
+    SRV_ALLOC(bench);
+    state->streaming_interval = 100;
+    if (report_interval)
+        state->next_report = now + jd_random() % report_interval;
+}
+
+void app_init_services(void) {
+    static srv_vt_t extra_vts[BENCH_MAX_SERVICES - 1];
+    bench_service_init();
+    for (uint32_t i = 1; i < num_bench_services; ++i) {
+        extra_vts[i - 1] = bench_vt;
+        extra_vts[i - 1].service_class += i;
+        srv_t *state = jd_allocate_service(&extra_vts[i - 1]);
+        state->streaming_interval = 100;
+    }
+    bench_init_services();
+}
+
+__attribute__((weak)) void bench_init_services(void) {}
+
+uint32_t app_get_device_class(void) {
+    return 0x3bec0c1a;
+}
+
+void jd_status(int status) {}
+
+void jd_app_handle_packet(jd_packet_t *pkt) {
+    if ((pkt->flags & JD_FRAME_FLAG_COMMAND) || pkt->service_command != JD_GET(JD_REG_READING) ||
+        pkt->service_size < 8)
+        return;
+    uint32_t *d = (uint32_t *)pkt->data;
+    jd_sim_probe(BENCH_PROBE_REPORT, pkt->device_identifier - BENCH_DEVICE_ID(0), now - d[1]);
+}
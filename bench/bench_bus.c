@@ -0,0 +1,290 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * N devices on one simulated wire, each streaming readings at a given interval.
+ *
+ * jacdac-c keeps its state in static variables, so every device is a separate copy of the node
+ * library (jacdac-c + hw_posix.c + alloc_posix.c + bench_app.c, built as a shared object),
+ * loaded with dlopen() from its own file. The simulator itself (jd_sim.c) lives in this
+ * executable, which has to be linked with -rdynamic, so that the nodes can call into it.
+ *
+ * Reports frames/s, collisions, goodput, and per-node latency from jd_send() to dispatch
+ * on the next node (the "listener").
+ *
+ * With -m, the first -M nodes load a different build of the node library, e.g. with another
+ * TX backoff policy, to see how the two fare against each other on the same wire.
+ */
+
+#include "bench.h"
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <unistd.h>
+
+typedef struct {
+    void (*start)(uint64_t device_id);
+    void (*set_report)(uint32_t interval_us, uint32_t size);
+    void (*set_report_copy)(int copy);
+    jd_diagnostics_t *(*get_diagnostics)(void);
+    jd_tx_class_stats_t *(*get_tx_stats)(void);
+
+    jd_diagnostics_t diag0;
+    jd_sim_node_stats_t st0;
+    uint32_t reports_queued;
+    uint32_t reports_failed;
+    uint32_t *lat;
+    uint32_t num_lat, lat_alloc;
+} node_t;
+
+static node_t *nodes;
+static uint32_t num_nodes = 8;
+static uint32_t interval_us = 20000;
+static uint32_t report_size = 8;
+static uint32_t duration_ms = 2000;
+static uint32_t report_copy;
+static int measuring;
+
+static void probe(int node, int kind, uint32_t a, uint32_t b) {
+    if (!measuring || node < 0)
+        return;
+    if (kind == BENCH_PROBE_REPORT_SENT) {
+        if (a)
+            nodes[node].reports_queued++;
+        else
+            nodes[node].reports_failed++;
+    } else if (kind == BENCH_PROBE_REPORT) {
+        if (a >= num_nodes || (a + 1) % num_nodes != (uint32_t)node)
+            return;
+        node_t *n = &nodes[a];
+        if (n->num_lat == n->lat_alloc) {
+            n->lat_alloc = n->lat_alloc ? n->lat_alloc * 2 : 1024;
+            n->lat = realloc(n->lat, n->lat_alloc * sizeof(uint32_t));
+        }
+        n->lat[n->num_lat++] = b;
+    }
+}
+
+static void *load_copy(const char *path, const void *image, size_t size) {
+    char tmp[] = "/tmp/jdnode-XXXXXX";
+    int fd = mkstemp(tmp);
+    if (fd < 0 || write(fd, image, size) != (ssize_t)size) {
+        perror(tmp);
+        exit(1);
+    }
+    close(fd);
+    // a separate file, so the dynamic loader doesn't reuse the previous copy
+    void *lib = dlopen(tmp, RTLD_NOW | RTLD_LOCAL);
+    unlink(tmp);
+    if (!lib) {
+        fprintf(stderr, "%s: %s\n", path, dlerror());
+        exit(1);
+    }
+    return lib;
+}
+
+static void *read_image(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    void *image = malloc(*size);
+    if (fread(image, 1, *size, f) != *size) {
+        perror(path);
+        exit(1);
+    }
+    fclose(f);
+    return image;
+}
+
+static void print_group(const char *name, uint32_t first, uint32_t num, double sim_s) {
+    uint64_t offered = 0;
+    uint32_t lat_n = 0;
+    for (uint32_t i = first; i < first + num; ++i)
+        lat_n += nodes[i].num_lat;
+    uint32_t *lat = malloc((lat_n + 1) * sizeof(uint32_t));
+    lat_n = 0;
+    for (uint32_t i = first; i < first + num; ++i) {
+        node_t *n = &nodes[i];
+        offered += n->reports_queued + n->reports_failed;
+        memcpy(lat + lat_n, n->lat, n->num_lat * sizeof(uint32_t));
+        lat_n += n->num_lat;
+    }
+    printf("%s (%u nodes): %.0f B/s of %.0f B/s offered (%.1f%%), latency p50 %uus p99 %uus\n",
+           name, num, lat_n * report_size / sim_s, offered * report_size / sim_s,
+           offered ? 100.0 * lat_n / offered : 0.0, bench_percentile(lat, lat_n, 50),
+           bench_percentile(lat, lat_n, 99));
+    free(lat);
+}
+
+static void *sym(void *lib, const char *name) {
+    void *r = dlsym(lib, name);
+    if (!r) {
+        fprintf(stderr, "missing symbol: %s\n", name);
+        exit(1);
+    }
+    return r;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s -l libjdnode.so [-N nodes] [-i interval_us] [-s size] [-t duration_ms] "
+            "[-c copy] [-L loop_us] [-m other.so -M other_nodes]\n",
+            prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *libpath = NULL, *otherpath = NULL;
+    uint32_t num_other = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-l")) {
+            libpath = argv[i + 1];
+            continue;
+        }
+        if (!strcmp(argv[i], "-m")) {
+            otherpath = argv[i + 1];
+            continue;
+        }
+        uint32_t v = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-N"))
+            num_nodes = v;
+        else if (!strcmp(argv[i], "-i"))
+            interval_us = v;
+        else if (!strcmp(argv[i], "-s"))
+            report_size = v;
+        else if (!strcmp(argv[i], "-t"))
+            duration_ms = v;
+        else if (!strcmp(argv[i], "-c"))
+            report_copy = v;
+        else if (!strcmp(argv[i], "-L"))
+            jd_sim_config.loop_us = v;
+        else if (!strcmp(argv[i], "-M"))
+            num_other = v;
+        else
+            usage(argv[0]);
+    }
+    if (!libpath || num_nodes < 2 || num_nodes > JD_SIM_MAX_NODES)
+        usage(argv[0]);
+    if (!otherpath)
+        num_other = 0;
+    if (num_other > num_nodes)
+        num_other = num_nodes;
+    if (report_size < 8)
+        report_size = 8;
+    if (report_size > JD_SERIAL_PAYLOAD_SIZE)
+        report_size = JD_SERIAL_PAYLOAD_SIZE;
+
+    size_t size, other_size = 0;
+    void *image = read_image(libpath, &size);
+    void *other_image = num_other ? read_image(otherpath, &other_size) : NULL;
+
+    jd_sim_reset();
+    jd_sim_set_probe(probe);
+
+    nodes = calloc(num_nodes, sizeof(node_t));
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        node_t *n = &nodes[i];
+        void *lib = i < num_other ? load_copy(otherpath, other_image, other_size)
+                                  : load_copy(libpath, image, size);
+        n->start = sym(lib, "jd_posix_start");
+        n->set_report = sym(lib, "bench_set_report");
+        n->set_report_copy = sym(lib, "bench_set_report_copy");
+        n->get_diagnostics = sym(lib, "jd_get_diagnostics");
+        n->get_tx_stats = sym(lib, "jd_tx_get_stats");
+        n->set_report(interval_us, report_size);
+        n->set_report_copy(report_copy);
+        n->start(BENCH_DEVICE_ID(i));
+    }
+    free(image);
+    free(other_image);
+
+    // skip the initial announce storm
+    jd_sim_run_until(500000);
+
+    jd_sim_wire_stats_t wire0 = *jd_sim_wire_stats();
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        nodes[i].diag0 = *nodes[i].get_diagnostics();
+        nodes[i].st0 = *jd_sim_node_stats(i);
+    }
+
+    uint64_t t0 = jd_sim_now();
+    uint64_t wall0 = bench_wall_ns();
+    measuring = 1;
+    jd_sim_run_until(t0 + duration_ms * 1000ULL);
+    measuring = 0;
+    uint64_t wall = bench_wall_ns() - wall0;
+    double sim_s = (jd_sim_now() - t0) / 1e6;
+
+    jd_sim_wire_stats_t *wire = jd_sim_wire_stats();
+    uint32_t frames = wire->frames - wire0.frames;
+    uint32_t collisions = wire->collisions - wire0.collisions;
+    uint64_t busy = wire->busy_us - wire0.busy_us;
+
+    printf("%u nodes, reading of %u bytes every %uus, %.3fs simulated\n", num_nodes, report_size,
+           interval_us, sim_s);
+    printf("wire: %.0f frames/s, %.1f%% collided, %.1f%% utilization\n", frames / sim_s,
+           frames ? 100.0 * collisions / frames : 0.0, 100.0 * busy / (sim_s * 1e6));
+
+    uint64_t offered = 0, delivered = 0;
+    uint32_t all_lat_n = 0;
+    for (uint32_t i = 0; i < num_nodes; ++i)
+        all_lat_n += nodes[i].num_lat;
+    uint32_t *all_lat = malloc((all_lat_n + 1) * sizeof(uint32_t));
+    all_lat_n = 0;
+
+    printf("node  frames  coll  lo_err  crc_err  dropped  queued  failed  delivered  p50us  p99us\n");
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        node_t *n = &nodes[i];
+        jd_diagnostics_t *d = n->get_diagnostics();
+        jd_sim_node_stats_t *st = jd_sim_node_stats(i);
+        offered += n->reports_queued + n->reports_failed;
+        delivered += n->num_lat;
+        memcpy(all_lat + all_lat_n, n->lat, n->num_lat * sizeof(uint32_t));
+        all_lat_n += n->num_lat;
+        printf("%4u  %6u  %4u  %6u  %7u  %7u  %6u  %6u  %9u  %5u  %5u\n", i,
+               st->frames_sent - n->st0.frames_sent, st->collisions - n->st0.collisions,
+               d->bus_lo_error - n->diag0.bus_lo_error,
+               d->bus_uart_error - n->diag0.bus_uart_error,
+               d->packets_dropped + d->rx_queue_overflow - n->diag0.packets_dropped -
+                   n->diag0.rx_queue_overflow,
+               n->reports_queued,
+               n->reports_failed, n->num_lat, bench_percentile(n->lat, n->num_lat, 50),
+               bench_percentile(n->lat, n->num_lat, 99));
+    }
+
+    printf("goodput: %.0f B/s of %.0f B/s offered (%.1f%%), latency p50 %uus p99 %uus\n",
+           delivered * report_size / sim_s, offered * report_size / sim_s,
+           offered ? 100.0 * delivered / offered : 0.0, bench_percentile(all_lat, all_lat_n, 50),
+           bench_percentile(all_lat, all_lat_n, 99));
+    if (num_other) {
+        print_group(otherpath, 0, num_other, sim_s);
+        print_group(libpath, num_other, num_nodes - num_other, sim_s);
+    }
+    uint64_t packets = 0, copied = 0;
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        jd_tx_class_stats_t *txst = nodes[i].get_tx_stats();
+        for (int c = 0; c < JD_TX_NUM_CLASSES; ++c) {
+            packets += txst[c].packets_queued;
+            copied += txst[c].bytes_copied;
+        }
+    }
+    printf("jd_send() copied %.1f bytes per packet (%s readings)\n",
+           packets ? (double)copied / packets : 0.0, report_copy ? "copied" : "reserved");
+    uint64_t loops = 0, loop_ns = 0;
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        jd_sim_node_stats_t *st = jd_sim_node_stats(i);
+        loops += st->num_loop - nodes[i].st0.num_loop;
+        loop_ns += st->cpu_ns_loop - nodes[i].st0.cpu_ns_loop;
+    }
+    printf("main loop: %.0f iterations/s per node, %.1fus cpu per node per second (%s)\n",
+           loops / sim_s / num_nodes, loop_ns / 1e3 / sim_s / num_nodes,
+           jd_sim_config.loop_us ? "periodic" : "sleeping between deadlines");
+    printf("wall time: %.3fs (%.1fx real time)\n", wall / 1e9, sim_s / (wall / 1e9));
+
+    return 0;
+}
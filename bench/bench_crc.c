@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Speed of jd_crc16() in the variant selected with JD_CONFIG_CRC16.
+ * Checks it against the reference (bitwise) implementation first.
+ * Only needs source/jd_crc.c; build once per variant.
+ *
+ * With JD_CONFIG_CRC_HW=1, jd_crc16() goes through crc_hw_*() - link with the host mock
+ * (source/interfaces/posix/crc_hw_posix.c) to check the results, and the cost of dispatching
+ * to the peripheral compared to calling crc_hw_*() directly.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES() __rdtsc()
+#define UNIT "cycles"
+#else
+#define CYCLES() bench_wall_ns()
+#define UNIT "ns"
+#endif
+
+static const char *variant_names[] = {"bitwise", "nibble", "table", "slice4"};
+
+typedef uint16_t (*crc_fn_t)(uint16_t crc, const void *data, uint32_t size);
+
+#if JD_CONFIG_CRC_HW == 1
+// jd_crc.c needs these, to claim the peripheral
+void target_disable_irq(void) {}
+void target_enable_irq(void) {}
+
+static uint16_t crc_hw_direct(uint16_t crc, const void *data, uint32_t size) {
+    crc_hw_start(crc, data, size);
+    return crc_hw_complete();
+}
+#endif
+
+static uint16_t crc16_ref(const void *data, uint32_t size) {
+    const uint8_t *ptr = (const uint8_t *)data;
+    uint16_t crc = 0xffff;
+    while (size--) {
+        uint8_t x = (crc >> 8) ^ *ptr++;
+        x ^= x >> 4;
+        crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x;
+    }
+    return crc;
+}
+
+static int check(void) {
+    uint8_t buf[300 + 3];
+    if (jd_crc16("123456789", 9) != 0x29b1) {
+        fprintf(stderr, "check value mismatch: %04x\n", jd_crc16("123456789", 9));
+        return -1;
+    }
+    srand(1);
+    for (uint32_t len = 0; len <= 300; ++len) {
+        for (int iter = 0; iter < 20; ++iter) {
+            for (uint32_t i = 0; i < sizeof(buf); ++i)
+                buf[i] = rand();
+            // also try all alignments
+            const uint8_t *p = buf + (iter & 3);
+            if (jd_crc16(p, len) != crc16_ref(p, len)) {
+                fprintf(stderr, "mismatch at len=%u\n", len);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// best of a few rounds, to filter out interrupts and frequency scaling
+static uint64_t measure(crc_fn_t fn, uint8_t *data, uint32_t size, uint32_t iters) {
+    volatile uint16_t sink = 0;
+    uint64_t best = ~0ULL;
+    for (int round = 0; round < 5; ++round) {
+        uint64_t c0 = CYCLES();
+        for (uint32_t i = 0; i < iters; ++i) {
+            data[0] = i;
+            sink ^= fn(0xffff, data, size);
+        }
+        uint64_t c = CYCLES() - c0;
+        if (c < best)
+            best = c;
+    }
+    (void)sink;
+    return best;
+}
+
+int main(int argc, char **argv) {
+    uint32_t size = JD_SERIAL_PAYLOAD_SIZE;
+    uint32_t iters = 200000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        uint32_t v = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-s") && v > 0 && v <= 1024)
+            size = v;
+        else if (!strcmp(argv[i], "-n") && v > 0)
+            iters = v;
+        else {
+            fprintf(stderr, "usage: %s [-s size] [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (check())
+        return 1;
+
+    // the CRC covers the frame starting at offset 2, so the data is never word-aligned
+    uint8_t *buf = malloc(size + 2);
+    for (uint32_t i = 0; i < size + 2; ++i)
+        buf[i] = rand();
+    uint8_t *data = buf + 2;
+
+    uint64_t wall0 = bench_wall_ns();
+    uint64_t c = measure(jd_crc16_update, data, size, iters);
+    uint64_t wall = bench_wall_ns() - wall0;
+    printf("jd_crc16 (%s%s): %u bytes, %.2f " UNIT "/byte, %.0f MB/s\n",
+           variant_names[JD_CONFIG_CRC16], JD_CONFIG_CRC_HW ? ", hw" : "", size,
+           (double)c / iters / size, 5.0 * iters * size / (wall / 1e3));
+
+    // cost of a call for a small chunk, where fixed overheads dominate
+    c = measure(jd_crc16_update, data, 4, iters);
+    printf("jd_crc16_update: %.1f " UNIT " per 4-byte call\n", (double)c / iters);
+#if JD_CONFIG_CRC_HW == 1
+    uint64_t direct = measure(crc_hw_direct, data, 4, iters);
+    printf("crc_hw_*() directly: %.1f " UNIT " per 4-byte call; dispatch overhead %.1f " UNIT
+           "\n",
+           (double)direct / iters, ((double)c - direct) / iters);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Cost of jd_services_handle_packet() for broadcast packets (addressed to a service class),
+ * on a device with many services. Most broadcasts on a busy bus are for classes the device
+ * doesn't have; -m sets how many in 100 are for one of its services.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+static void drain_tx(void) {
+    jd_frame_t *f;
+    jd_tx_flush();
+    while ((f = jd_tx_get_frame()) != NULL)
+        jd_tx_frame_sent(f);
+}
+
+int main(int argc, char **argv) {
+    uint32_t iters = 1000000;
+    uint32_t num_services = 16;
+    uint32_t match_pct = 10;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        uint32_t v = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-n"))
+            iters = v;
+        else if (!strcmp(argv[i], "-S"))
+            num_services = v;
+        else if (!strcmp(argv[i], "-m"))
+            match_pct = v;
+        else {
+            fprintf(stderr, "usage: %s [-n packets] [-S services] [-m match_pct]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench_set_num_services(num_services);
+    jd_sim_reset();
+    jd_posix_start(0x1234);
+
+    jd_frame_t frame;
+    jd_packet_t *pkt = (jd_packet_t *)&frame;
+    uint32_t matched = 0;
+    uint64_t t0 = bench_wall_ns();
+    for (uint32_t i = 0; i < iters; ++i) {
+        uint32_t r = jd_random();
+        uint32_t cls;
+        if (r % 100 < match_pct) {
+            cls = BENCH_SERVICE_CLASS + (r >> 8) % num_services;
+            matched++;
+        } else {
+            // classes of other devices on the bus
+            cls = 0x10000000 + (r >> 8) % 64;
+        }
+        frame.flags = JD_FRAME_FLAG_COMMAND | JD_FRAME_FLAG_IDENTIFIER_IS_SERVICE_CLASS;
+        frame.device_identifier = cls;
+        pkt->service_size = 0;
+        pkt->service_index = 0;
+        pkt->service_command = JD_GET(JD_REG_INTENSITY);
+        jd_services_handle_packet(pkt);
+        if ((i & 15) == 15)
+            drain_tx();
+    }
+    uint64_t ns = bench_wall_ns() - t0;
+
+    printf("%u services, %u broadcasts (%u for a local service)\n", num_services + 1, iters,
+           matched);
+    printf("%.1fns per packet\n", (double)ns / iters);
+    return 0;
+}
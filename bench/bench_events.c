@@ -0,0 +1,229 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Event queue under load: a service sends bursts of events (like multitouch or an
+ * accelerometer), every event is sent once and re-transmitted twice by the event queue.
+ * Measures the CPU spent queuing events and in the main loop, and counts event packets
+ * on the wire. Build with a larger JD_EVENT_QUEUE_SIZE to see how the queue scales.
+ * -R/-F/-I set the service's re-transmission policy; with -A (and JD_CONFIG_EVENT_ACK), a client
+ * ACKs every frame that asks for it, after -a us.
+ * With -C (and JD_CONFIG_EVENT_COALESCE), the events of a burst are coalesced: -C 1 sends them in
+ * one batch, -C 2 treats the event codes as two state events (1/3 and 2/4), so that only the last
+ * one of each is sent.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+#define DUT_ID 0x1122334455667788ULL
+#define SOURCE_SERVICE_CLASS 0x1bec0e1a
+
+static uint32_t rate = 500;
+static uint32_t burst = 10;
+static uint32_t data_size = 4;
+static uint32_t duration_ms = 10000;
+static jd_event_policy_t policy = {
+    .retransmits = JD_EVENT_RETRANSMITS,
+    .first_ms = JD_EVENT_RETRANSMIT_FIRST_MS,
+    .interval_ms = JD_EVENT_RETRANSMIT_INTERVAL_MS,
+};
+static uint32_t ack_delay_us = 300;
+static uint32_t coalesce;
+
+static const jd_event_coalesce_t batch_rules[] = {{1, 0, 0}, {2, 0, 0}, {3, 0, 0}, {4, 0, 0}};
+static const jd_event_coalesce_t state_rules[] = {{1, 1, 0}, {2, 2, 0}, {3, 1, 0}, {4, 2, 0}};
+
+// CRC ACKs the client owes
+#define MAX_ACKS 64
+static struct {
+    uint64_t when;
+    uint16_t crc;
+} acks[MAX_ACKS];
+static uint32_t num_acks;
+
+static int stopped;
+static uint32_t events_sent, packets_seen, events_seen;
+static uint64_t enqueue_ns;
+
+struct srv_state {
+    SRV_COMMON;
+    uint32_t next;
+};
+
+REG_DEFINITION(     //
+    source_regs,    //
+    REG_SRV_COMMON, //
+)
+
+static void source_process(srv_t *state) {
+    uint32_t period = (uint64_t)burst * 1000000 / rate;
+    if (stopped) {
+        jd_services_wake_on_packet(state);
+        return;
+    }
+    if (!jd_should_sample(&state->next, period)) {
+        jd_services_wake_at(state, state->next);
+        return;
+    }
+    uint8_t data[JD_SERIAL_PAYLOAD_SIZE] = {0};
+    uint64_t t0 = bench_wall_ns();
+    for (uint32_t i = 0; i < burst; ++i) {
+        data[0] = i;
+        jd_send_event_ext(state, 1 + i % 4, data, data_size);
+    }
+    enqueue_ns += bench_wall_ns() - t0;
+    events_sent += burst;
+    jd_services_wake_at(state, state->next);
+}
+
+static void source_handle_packet(srv_t *state, jd_packet_t *pkt) {
+    service_handle_register_final(state, pkt, source_regs);
+}
+
+SRV_DEF(source, SOURCE_SERVICE_CLASS);
+void bench_init_services(void) {
+    SRV_ALLOC(source);
+    state->next = now + 100000;
+    jd_event_set_policy(state, &policy);
+    if (coalesce)
+        jd_event_set_coalesce(state, coalesce == 1 ? batch_rules : state_rules, 4);
+}
+
+static void monitor(int node, const uint8_t *data, uint32_t len, uint64_t start, uint64_t end,
+                    int collided) {
+    if (node != 0 || collided)
+        return;
+    jd_frame_t frame;
+    memcpy(&frame, data, len);
+    if (policy.ack && (frame.flags & JD_FRAME_FLAG_ACK_REQUESTED) && num_acks < MAX_ACKS) {
+        acks[num_acks].when = end + ack_delay_us;
+        acks[num_acks].crc = frame.crc;
+        num_acks++;
+    }
+    for (;;) {
+        jd_packet_t *pkt = (jd_packet_t *)&frame;
+        if (pkt->service_command & JD_CMD_EVENT_MASK) {
+            packets_seen++;
+            if ((pkt->service_command & JD_CMD_EVENT_CODE_MASK) == JD_EV_BATCH)
+                for (unsigned ptr = 0; ptr + 2 <= pkt->service_size; ptr += pkt->data[ptr] + 2)
+                    events_seen++;
+            else
+                events_seen++;
+        }
+        if (!jd_shift_frame(&frame))
+            break;
+    }
+}
+
+// the client sends its ACKs (one per frame, as jd_services_process_frame() does)
+static void run_until(uint64_t until) {
+    while (jd_sim_now() < until) {
+        // the monitor can add ACKs in the meantime
+        uint64_t t = jd_sim_now() + 200;
+        if (t > until)
+            t = until;
+        if (num_acks && acks[0].when < t)
+            t = acks[0].when;
+        jd_sim_run_until(t);
+        if (num_acks && acks[0].when <= jd_sim_now()) {
+            jd_frame_t frame;
+            jd_reset_frame(&frame);
+            frame.flags = 0;
+            frame.device_identifier = BENCH_DEVICE_ID(1);
+            jd_push_in_frame(&frame, JD_SERVICE_INDEX_CRC_ACK, acks[0].crc, 0);
+            jd_compute_crc(&frame);
+            if (jd_sim_inject(&frame, JD_FRAME_SIZE(&frame)) == 0) {
+                num_acks--;
+                memmove(acks, acks + 1, num_acks * sizeof(acks[0]));
+                // not before this one is on the wire
+                if (num_acks && acks[0].when < jd_sim_now() + 300)
+                    acks[0].when = jd_sim_now() + 300;
+            } else {
+                acks[0].when += 100; // line busy
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        uint32_t v = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-r"))
+            rate = v;
+        else if (!strcmp(argv[i], "-b"))
+            burst = v;
+        else if (!strcmp(argv[i], "-d"))
+            data_size = v;
+        else if (!strcmp(argv[i], "-t"))
+            duration_ms = v;
+        else if (!strcmp(argv[i], "-L"))
+            jd_sim_config.loop_us = v;
+        else if (!strcmp(argv[i], "-R"))
+            policy.retransmits = v;
+        else if (!strcmp(argv[i], "-F"))
+            policy.first_ms = v;
+        else if (!strcmp(argv[i], "-I"))
+            policy.interval_ms = v;
+        else if (!strcmp(argv[i], "-A"))
+            policy.ack = v;
+        else if (!strcmp(argv[i], "-a"))
+            ack_delay_us = v;
+        else if (!strcmp(argv[i], "-C"))
+            coalesce = v;
+        else {
+            fprintf(stderr,
+                    "usage: %s [-r events_per_s] [-b burst] [-d data_bytes] [-t duration_ms] "
+                    "[-L loop_us] [-R retransmits] [-F first_ms] [-I interval_ms] [-A ack] "
+                    "[-a ack_delay_us] [-C coalesce]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (!rate || !burst || data_size > JD_SERIAL_PAYLOAD_SIZE ||
+        policy.retransmits > JD_EVENT_MAX_RETRANSMITS || (policy.ack && !JD_CONFIG_EVENT_ACK) ||
+        coalesce > 2 || (coalesce && !JD_CONFIG_EVENT_COALESCE)) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+
+    jd_sim_reset();
+    jd_sim_set_monitor(monitor);
+    jd_posix_start(DUT_ID);
+
+    jd_sim_node_stats_t st0 = *jd_sim_node_stats(0);
+    jd_sim_wire_stats_t w0 = *jd_sim_wire_stats();
+    uint64_t t0 = jd_sim_now();
+    run_until(t0 + duration_ms * 1000ULL);
+    stopped = 1;
+    uint32_t sent = events_sent;
+    // let the re-transmissions finish
+    run_until(jd_sim_now() + 200000 + 3 * policy.interval_ms * 1000);
+    double sim_s = (jd_sim_now() - t0) / 1e6;
+    jd_sim_node_stats_t *st = jd_sim_node_stats(0);
+    jd_event_stats_t *es = jd_event_get_stats();
+
+    printf("%u events/s in bursts of %u, %u data bytes, %u byte queue\n", rate, burst, data_size,
+           JD_EVENT_QUEUE_SIZE);
+    printf("events sent:      %u\n", sent);
+    printf("policy:           %u re-transmissions, after %ums, then every %ums%s\n",
+           policy.retransmits, policy.first_ms, policy.interval_ms,
+           policy.ack ? ", until ACKed" : "");
+    printf("on the wire:      %.2f packets per event (%u with no drops)\n",
+           (double)packets_seen / sent, 1 + policy.retransmits);
+    if (coalesce)
+        printf("coalesced:        %u batches, %u events superseded, %.2f events per packet, "
+               "%.2f copies of each event sent\n",
+               es->batches, es->superseded, (double)events_seen / packets_seen,
+               (double)events_seen / (sent - es->superseded));
+    printf("re-transmissions: %u sent, %u saved by ACKs, %u dropped (queue full)\n",
+           es->retransmits, es->retransmits_acked, es->retransmits_dropped);
+    printf("bus busy:         %.1f%%\n",
+           (jd_sim_wire_stats()->busy_us - w0.busy_us) / (sim_s * 1e4));
+    printf("cpu enqueue:      %.0fns per event (including the first jd_send())\n",
+           (double)enqueue_ns / sent);
+    printf("cpu main loop:    %.0fus per second (including the above)\n",
+           (st->cpu_ns_loop - st0.cpu_ns_loop) / 1000.0 / sim_s);
+    return 0;
+}
@@ -0,0 +1,208 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Sampling jitter of a service, while another service on the same device regularly waits for
+ * "hardware" (like a sensor driver waiting for a measurement): either in jd_services_sleep_us(),
+ * which keeps other services from running, or in a coroutine (JD_CORO_SLEEP_US()).
+ * The bench service samples (and streams a reading) at a fixed interval; lateness is measured
+ * from the time the sample was due.
+ * At the end, the per-service profile and heap usage are read over the wire
+ * (JD_CONTROL_CMD_SERVICE_PROFILE, JD_CONTROL_REG_HEAP_USAGE).
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+#define DUT_ID 0x1122334455667788ULL
+#define WAITER_SERVICE_CLASS 0x1bec0d1a
+
+static uint32_t interval_us = 1000;
+static uint32_t wait_us = 10000;
+static uint32_t period_us = 100000;
+static uint32_t duration_ms = 10000;
+static uint32_t use_coro = 1;
+
+static uint32_t *lateness, num_lateness, lateness_alloc;
+static int measuring;
+static int got_profile, got_heap;
+
+struct srv_state {
+    SRV_COMMON;
+    uint32_t next;
+    uint32_t cycles;
+    jd_coro_t co;
+    uint8_t *buf; // like a driver's buffer for measurements
+};
+
+REG_DEFINITION(     //
+    waiter_regs,    //
+    REG_SRV_COMMON, //
+)
+
+static srv_t *waiter;
+
+// two waits for the "hardware", like a command and a measurement
+static int waiter_run(srv_t *state) {
+    JD_CORO_BEGIN(&state->co);
+    JD_CORO_SLEEP_US(&state->co, wait_us);
+    JD_CORO_SLEEP_US(&state->co, wait_us);
+    state->cycles++;
+    JD_CORO_END(&state->co);
+}
+
+static void waiter_process(srv_t *state) {
+    if (!use_coro) {
+        if (jd_should_sample(&state->next, period_us)) {
+            jd_services_sleep_us(wait_us);
+            jd_services_sleep_us(wait_us);
+            state->cycles++;
+        }
+        return;
+    }
+
+    if (!state->co.line && !jd_should_sample(&state->next, period_us)) {
+        jd_services_wake_at(state, state->next);
+        return;
+    }
+    if (waiter_run(state) == JD_CORO_WAITING)
+        jd_services_wake_at(state, state->co.wake);
+    else
+        jd_services_wake_at(state, state->next);
+}
+
+static void waiter_handle_packet(srv_t *state, jd_packet_t *pkt) {
+    service_handle_register_final(state, pkt, waiter_regs);
+}
+
+SRV_DEF(waiter, WAITER_SERVICE_CLASS);
+void bench_init_services(void) {
+    SRV_ALLOC(waiter);
+    state->buf = jd_alloc(64);
+    state->next = now + period_us / 2;
+    waiter = state;
+}
+
+static void probe(int node, int kind, uint32_t a, uint32_t b) {
+    if (!measuring || kind != BENCH_PROBE_REPORT_SENT)
+        return;
+    if (num_lateness == lateness_alloc) {
+        lateness_alloc = lateness_alloc ? lateness_alloc * 2 : 1024;
+        lateness = realloc(lateness, lateness_alloc * sizeof(uint32_t));
+    }
+    lateness[num_lateness++] = b;
+}
+
+static void print_counter(const char *label, const jd_profile_counter_t *c) {
+    printf(" %s %7u calls, avg %6.0fns, max %9uns", label, c->calls,
+           c->calls ? (double)c->time / c->calls : 0.0, c->max_time);
+}
+
+static void monitor(int node, const uint8_t *data, uint32_t len, uint64_t start, uint64_t end,
+                    int collided) {
+    if (node != 0 || collided)
+        return;
+    jd_frame_t frame;
+    memcpy(&frame, data, len);
+    for (;;) {
+        jd_packet_t *pkt = (jd_packet_t *)&frame;
+        if (pkt->service_index == JD_SERVICE_INDEX_CONTROL &&
+            pkt->service_command == JD_CONTROL_CMD_SERVICE_PROFILE && pkt->service_size >= 4) {
+            unsigned n = (pkt->service_size - 4) / sizeof(jd_service_profile_t);
+            jd_service_profile_t *p = (jd_service_profile_t *)(pkt->data + 4);
+            for (unsigned i = 0; i < n; ++i) {
+                printf("service %u:", pkt->data[0] + i);
+                print_counter("process()", &p[i].process);
+                print_counter("handle_pkt()", &p[i].packet);
+                printf("\n");
+            }
+            got_profile = 1;
+        }
+        if (pkt->service_index == JD_SERVICE_INDEX_CONTROL &&
+            pkt->service_command == JD_GET(JD_CONTROL_REG_HEAP_USAGE) &&
+            pkt->service_size >= sizeof(jd_control_heap_usage_t)) {
+            jd_control_heap_usage_t *h = (jd_control_heap_usage_t *)pkt->data;
+            printf("heap: %u of %u bytes in use (max %u), %u left, stack max %u\n", h->in_use,
+                   h->heap_size, h->max_in_use, h->available, h->max_stack);
+            uint16_t *p = (uint16_t *)(h + 1);
+            for (unsigned i = 0; i < h->num_services; ++i)
+                printf("service %u: heap %u bytes (max %u)\n", i, p[2 * i], p[2 * i + 1]);
+            got_heap = 1;
+        }
+        if (!jd_shift_frame(&frame))
+            break;
+    }
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        uint32_t v = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-i"))
+            interval_us = v;
+        else if (!strcmp(argv[i], "-w"))
+            wait_us = v;
+        else if (!strcmp(argv[i], "-p"))
+            period_us = v;
+        else if (!strcmp(argv[i], "-t"))
+            duration_ms = v;
+        else if (!strcmp(argv[i], "-m"))
+            use_coro = v;
+        else if (!strcmp(argv[i], "-L"))
+            jd_sim_config.loop_us = v;
+        else {
+            fprintf(stderr,
+                    "usage: %s [-i interval_us] [-w wait_us] [-p period_us] [-t duration_ms] "
+                    "[-m coroutine] [-L loop_us]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    // otherwise jd_services_sleep_us() would never see the clock move
+    jd_sim_config.clock_read_us = 1;
+
+    jd_sim_reset();
+    jd_sim_set_probe(probe);
+    jd_sim_set_monitor(monitor);
+    bench_set_report(interval_us, 8);
+    jd_posix_start(DUT_ID);
+
+    jd_sim_run_until(500000);
+    uint32_t cycles0 = waiter->cycles;
+    jd_sim_node_stats_t st0 = *jd_sim_node_stats(0);
+
+    uint64_t t0 = jd_sim_now();
+    measuring = 1;
+    jd_sim_run_until(t0 + duration_ms * 1000ULL);
+    measuring = 0;
+    double sim_s = (jd_sim_now() - t0) / 1e6;
+    jd_sim_node_stats_t *st = jd_sim_node_stats(0);
+
+    uint32_t n = num_lateness;
+    printf("sampling every %uus; every %uus another service waits 2x %uus %s\n", interval_us,
+           period_us, wait_us, use_coro ? "in a coroutine" : "in jd_services_sleep_us()");
+    printf("waits completed:  %u\n", waiter->cycles - cycles0);
+    printf("samples:          %u of %.0f\n", n, sim_s * 1e6 / interval_us);
+    printf("lateness:         p50 %uus p99 %uus max %uus\n", bench_percentile(lateness, n, 50),
+           bench_percentile(lateness, n, 99), bench_percentile(lateness, n, 100));
+    printf("main loop:        %.0f iterations/s\n", (st->num_loop - st0.num_loop) / sim_s);
+
+    // what a host would do to profile a device in the field
+    jd_frame_t frame;
+    jd_reset_frame(&frame);
+    frame.flags = JD_FRAME_FLAG_COMMAND;
+    frame.device_identifier = DUT_ID;
+    jd_push_in_frame(&frame, JD_SERVICE_INDEX_CONTROL, JD_CONTROL_CMD_SERVICE_PROFILE, 0);
+    jd_push_in_frame(&frame, JD_SERVICE_INDEX_CONTROL, JD_GET(JD_CONTROL_REG_HEAP_USAGE), 0);
+    jd_compute_crc(&frame);
+    uint64_t t = jd_sim_now();
+    while (!(got_profile && got_heap) && t < t0 + (duration_ms + 1000) * 1000ULL) {
+        jd_sim_inject(&frame, JD_FRAME_SIZE(&frame));
+        t += 30000;
+        jd_sim_run_until(t);
+    }
+    if (!got_profile)
+        printf("no profile (JD_CONFIG_SERVICE_PROFILE disabled?)\n");
+    return 0;
+}
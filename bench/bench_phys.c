@@ -0,0 +1,224 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Single device on a simulated wire. An external peer sends a mix of frames:
+ * pings to the device (which it answers), commands for other devices, and announce packets.
+ * Reports wire throughput, ping latency and CPU time spent per frame.
+ * With -c, the received data is also handed to jd_rx_data_received() in chunks while the frame
+ * is arriving, which moves most of the CRC computation out of jd_rx_completed().
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+#define DUT_ID 0x1122334455667788ULL
+#define PEER_ID 0x0102030405060708ULL
+
+static uint32_t num_frames = 20000;
+static uint32_t interval_us = 400;
+static uint32_t ping_size = 8;
+
+static uint64_t *ping_sent_at;
+static uint32_t *dispatch_lat, num_dispatch;
+static uint32_t *response_lat, num_response;
+
+static void probe(int node, int kind, uint32_t a, uint32_t b) {
+    if (kind == BENCH_PROBE_DISPATCH && a < num_frames)
+        dispatch_lat[num_dispatch++] = b;
+}
+
+static void monitor(int node, const uint8_t *data, uint32_t len, uint64_t start, uint64_t end,
+                    int collided) {
+    if (node != 0)
+        return;
+
+    jd_frame_t frame;
+    memcpy(&frame, data, len);
+    for (;;) {
+        jd_packet_t *pkt = (jd_packet_t *)&frame;
+        if (pkt->service_command == BENCH_CMD_PING && pkt->service_size >= 8) {
+            uint32_t seq = *(uint32_t *)pkt->data;
+            if (seq < num_frames && ping_sent_at[seq])
+                response_lat[num_response++] = end - ping_sent_at[seq];
+        }
+        if (!jd_shift_frame(&frame))
+            break;
+    }
+}
+
+static uint32_t build_frame(jd_frame_t *frame, uint32_t seq) {
+    jd_reset_frame(frame);
+    frame->flags = 0;
+    switch (seq % 4) {
+    case 0:
+    case 2: {
+        frame->flags = JD_FRAME_FLAG_COMMAND;
+        frame->device_identifier = DUT_ID;
+        uint32_t *d = jd_push_in_frame(frame, 1, BENCH_CMD_PING, ping_size);
+        memset(d, 0, ping_size);
+        d[0] = seq;
+        d[1] = (uint32_t)jd_sim_now();
+        break;
+    }
+    case 1:
+        // command for another device - should be ignored
+        frame->flags = JD_FRAME_FLAG_COMMAND;
+        frame->device_identifier = PEER_ID + 1;
+        jd_push_in_frame(frame, 1, JD_GET(JD_REG_VALUE), 0);
+        break;
+    case 3: {
+        uint32_t *d = jd_push_in_frame(frame, JD_SERVICE_INDEX_CONTROL, JD_CONTROL_CMD_SERVICES, 8);
+        frame->device_identifier = PEER_ID;
+        d[0] = JD_CONTROL_ANNOUNCE_FLAGS_SUPPORTS_ACK;
+        d[1] = BENCH_SERVICE_CLASS;
+        break;
+    }
+    }
+    jd_compute_crc(frame);
+    return JD_FRAME_SIZE(frame);
+}
+
+// bucket upper bounds in us, then the counts since 'h0'
+static void print_hist(const char *label, const uint16_t *h, const uint16_t *h0) {
+    printf("%s", label);
+    for (int i = 0; i < JD_DIAG_HIST_BUCKETS; ++i) {
+        if (i == JD_DIAG_HIST_BUCKETS - 1)
+            printf(" >:%u", h[i] - h0[i]);
+        else
+            printf(" <%u:%u", 128 << i, h[i] - h0[i]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+        uint32_t v = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-n"))
+            num_frames = v;
+        else if (!strcmp(argv[i], "-i"))
+            interval_us = v;
+        else if (!strcmp(argv[i], "-s"))
+            ping_size = v < 8 ? 8 : v > JD_SERIAL_PAYLOAD_SIZE ? JD_SERIAL_PAYLOAD_SIZE : v;
+        else if (!strcmp(argv[i], "-c"))
+            jd_sim_config.rx_chunk_bytes = v;
+        else if (!strcmp(argv[i], "-L"))
+            jd_sim_config.loop_us = v;
+        else {
+            fprintf(stderr,
+                    "usage: %s [-n frames] [-i interval_us] [-s ping_size] [-c rx_chunk] "
+                    "[-L loop_us]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    ping_sent_at = calloc(num_frames, sizeof(uint64_t));
+    dispatch_lat = calloc(num_frames, sizeof(uint32_t));
+    response_lat = calloc(num_frames, sizeof(uint32_t));
+
+    jd_sim_reset();
+    jd_sim_set_monitor(monitor);
+    jd_sim_set_probe(probe);
+    jd_posix_start(DUT_ID);
+
+    // let the device announce itself
+    jd_sim_run_until(600000);
+    uint64_t busy0 = jd_sim_wire_stats()->busy_us;
+
+    jd_sim_node_stats_t *st = jd_sim_node_stats(0);
+    jd_sim_node_stats_t st0 = *st;
+    jd_get_diagnostics()->irq_disabled_max_ns = 0; // skip start-up
+    jd_diagnostics_t diag0 = *jd_get_diagnostics();
+    uint32_t rx0 = diag0.packets_received;
+
+    uint64_t wall0 = bench_wall_ns();
+    uint64_t t0 = jd_sim_now(), t = t0;
+    jd_frame_t frame;
+    for (uint32_t seq = 0; seq < num_frames;) {
+        t += interval_us;
+        jd_sim_run_until(t);
+        uint32_t len = build_frame(&frame, seq);
+        while (jd_sim_inject(&frame, len) != 0) {
+            // the device is talking - retry once it's done
+            t += 20;
+            jd_sim_run_until(t);
+            len = build_frame(&frame, seq);
+        }
+        if (seq % 4 == 0 || seq % 4 == 2)
+            ping_sent_at[seq] = t;
+        seq++;
+    }
+    t += 10000;
+    jd_sim_run_until(t);
+    uint64_t wall = bench_wall_ns() - wall0;
+
+    jd_diagnostics_t *diag = jd_get_diagnostics();
+    uint32_t rx = diag->packets_received - rx0;
+    double sim_s = (t - t0) / 1e6;
+    uint64_t irq_ns = st->cpu_ns_irq - st0.cpu_ns_irq;
+    uint64_t loop_ns = st->cpu_ns_loop - st0.cpu_ns_loop;
+    uint64_t busy = jd_sim_wire_stats()->busy_us - busy0;
+
+    printf("frames injected:    %u in %.3fs simulated (%.0f frames/s)\n", num_frames, sim_s,
+           num_frames / sim_s);
+    printf("frames received:    %u (dropped %u, filtered %u, uart err %u, lo err %u, timeout %u)\n",
+           rx, diag->packets_dropped, diag->packets_filtered - diag0.packets_filtered,
+           diag->bus_uart_error, diag->bus_lo_error, diag->bus_timeout_error);
+    printf("rx queue:           high water %u, overflow %u\n", diag->rx_queue_high_water,
+           diag->rx_queue_overflow);
+    static const char *class_names[JD_TX_NUM_CLASSES] = {"urgent", "response", "streaming"};
+    jd_tx_class_stats_t *txst = jd_tx_get_stats();
+    for (int i = 0; i < JD_TX_NUM_CLASSES; ++i)
+        printf("tx %-9s        %u packets queued, %u dropped, max depth %u\n", class_names[i],
+               txst[i].packets_queued, txst[i].packets_dropped, txst[i].max_depth);
+    printf("frames sent:        %u\n", st->frames_sent - st0.frames_sent);
+    printf("bus rx/tx:          %.1f%% / %.1f%% of the time\n",
+           100.0 * (diag->bus_rx_us - diag0.bus_rx_us) / (t - t0),
+           100.0 * (diag->bus_tx_us - diag0.bus_tx_us) / (t - t0));
+    print_hist("tx queue wait:     ", diag->tx_wait_hist, diag0.tx_wait_hist);
+    print_hist("rx dispatch:       ", diag->rx_dispatch_hist, diag0.rx_dispatch_hist);
+    printf("irq disabled:       max %uns\n", diag->irq_disabled_max_ns);
+    printf("wire utilization:   %.1f%%\n", 100.0 * busy / (t - t0));
+    printf("ping dispatch:      p50 %uus p99 %uus (%u pings)\n",
+           bench_percentile(dispatch_lat, num_dispatch, 50),
+           bench_percentile(dispatch_lat, num_dispatch, 99), num_dispatch);
+    printf("ping response:      p50 %uus p99 %uus (%u pongs)\n",
+           bench_percentile(response_lat, num_response, 50),
+           bench_percentile(response_lat, num_response, 99), num_response);
+    printf("cpu irq per frame:  %.0fns\n", rx ? (double)irq_ns / rx : 0.0);
+    printf("cpu rx done:        %.0fns per frame (rx chunks of %u bytes)\n",
+           st->num_rx_done > st0.num_rx_done
+               ? (double)(st->cpu_ns_rx_done - st0.cpu_ns_rx_done) /
+                     (st->num_rx_done - st0.num_rx_done)
+               : 0.0,
+           jd_sim_config.rx_chunk_bytes);
+    printf("cpu loop per frame: %.0fns (%u loop iterations)\n", rx ? (double)loop_ns / rx : 0.0,
+           st->num_loop - st0.num_loop);
+    printf("wall time:          %.3fs (%.1fx real time)\n", wall / 1e9, sim_s / (wall / 1e9));
+
+    // once the queue drains, a packet reserved and then aborted must not leave it non-idle
+    // (jd_ctrl_process() waits for jd_tx_is_idle() between flood pings)
+    while (!jd_tx_is_idle() && t < jd_sim_now() + 1000000) {
+        t += 1000;
+        jd_sim_run_until(t);
+    }
+    if (!jd_tx_is_idle() || !jd_send_reserve(JD_SERVICE_INDEX_CONTROL, 0x80, 4)) {
+        printf("tx queue not idle at the end\n");
+        return 1;
+    }
+    jd_send_abort();
+    if (!jd_tx_is_idle()) {
+        printf("tx queue not idle after jd_send_abort()\n");
+        return 1;
+    }
+    // same for a packet that doesn't fit in a frame at all
+    if (jd_send_reserve(JD_SERVICE_INDEX_CONTROL, 0x80, JD_SERIAL_PAYLOAD_SIZE + 1) ||
+        !jd_tx_is_idle()) {
+        printf("tx queue not idle after an oversized jd_send_reserve()\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Latency of service_handle_register() GET and SET, for a service with many registers.
+ * Registers are accessed in random order, so that the position in REG_DEFINITION() doesn't
+ * favor any of them. Build once with JD_CONFIG_REG_INDEX=0 and once with =1 to compare.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+
+#define NUM_REGS 24
+
+struct srv_state {
+    SRV_COMMON;
+    uint8_t flags_a : 1;
+    uint8_t flags_b : 1;
+    uint8_t flags_c : 1;
+    uint8_t u8[4];
+    int16_t i16[4];
+    uint32_t u32[8];
+    int32_t i32[4];
+    uint8_t name[12];
+};
+
+// clang-format off
+REG_DEFINITION(                 //
+    bench_regs,                 //
+    // REG_SRV_COMMON is sized for 32-bit targets; SRV_COMMON is larger with 64-bit pointers
+    REG_BYTES(JD_REG_PADDING, sizeof(void *) + 2), //
+    REG_BIT(0x80),              //
+    REG_BIT(0x81),              //
+    REG_BIT(0x82),              //
+    REG_U8(0x83), REG_U8(0x84), REG_U8(0x85), REG_U8(0x86),                                 //
+    REG_I16(0x87), REG_I16(0x88), REG_I16(0x89), REG_I16(0x8a),                             //
+    REG_U32(JD_REG_STREAMING_INTERVAL), REG_U32(0x8b), REG_U32(0x8c), REG_U32(0x8d),        //
+    REG_U32(0x8e), REG_U32(0x8f), REG_U32(0x90), REG_U32(JD_REG_INTENSITY),                 //
+    REG_I32(0x91), REG_I32(0x92), REG_I32(0x93), REG_I32(JD_REG_VALUE),                     //
+    REG_BYTES(0x94, 12),        //
+)
+// clang-format on
+
+static uint16_t reg_codes[NUM_REGS];
+static volatile uint32_t sink;
+
+static void drain_tx(void) {
+    jd_frame_t *f;
+    jd_tx_flush();
+    while ((f = jd_tx_get_frame()) != NULL)
+        jd_tx_frame_sent(f);
+}
+
+static uint64_t run(srv_t *state, uint16_t cmd_kind, uint32_t iters) {
+    jd_frame_t frame = {0};
+    jd_packet_t *pkt = (jd_packet_t *)&frame;
+    pkt->service_size = 4;
+    pkt->data[0] = 1;
+    uint64_t t0 = bench_wall_ns();
+    for (uint32_t i = 0; i < iters; ++i) {
+        pkt->service_command = cmd_kind | reg_codes[jd_random() % NUM_REGS];
+        if (service_handle_register(state, pkt, bench_regs) == 0)
+            jd_panic();
+        if ((i & 15) == 15)
+            drain_tx();
+    }
+    return bench_wall_ns() - t0;
+}
+
+int main(int argc, char **argv) {
+    uint32_t iters = 1000000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-n"))
+            iters = atoi(argv[i + 1]);
+        else {
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int n = 0;
+    for (int i = 0; bench_regs[i] != JD_REG_END; ++i) {
+        int code = bench_regs[i] & 0xfff;
+        if ((bench_regs[i] >> 12) == _REG_BYTES)
+            i++;
+        if (code < 0xf00)
+            reg_codes[n++] = code;
+    }
+    if (n != NUM_REGS) {
+        fprintf(stderr, "expecting %d registers, got %d\n", NUM_REGS, n);
+        return 1;
+    }
+
+    jd_sim_reset();
+    jd_posix_start(0x1234);
+
+    srv_t *state = calloc(1, sizeof(srv_t));
+    // not a registered service; any index that is not taken will do
+    state->service_index = JD_CONFIG_MAX_SERVICES - 1;
+    // what the service would do in its init
+    service_index_registers(state, bench_regs);
+    // warm up
+    run(state, JD_CMD_SET_REGISTER, 1000);
+    run(state, JD_CMD_GET_REGISTER, 1000);
+
+    // jd_random() and the TX queue drain are included in both; measure them separately
+    uint64_t base_t0 = bench_wall_ns();
+    for (uint32_t i = 0; i < iters; ++i) {
+        sink += reg_codes[jd_random() % NUM_REGS];
+        if ((i & 15) == 15)
+            drain_tx();
+    }
+    uint64_t base = bench_wall_ns() - base_t0;
+
+    uint64_t set_ns = run(state, JD_CMD_SET_REGISTER, iters);
+    uint64_t get_ns = run(state, JD_CMD_GET_REGISTER, iters);
+
+    printf("%d registers, %s lookup\n", NUM_REGS, JD_CONFIG_REG_INDEX ? "indexed" : "linear");
+    printf("SET: %.1fns per packet\n", (double)(set_ns - base) / iters);
+    printf("GET: %.1fns per packet (including jd_send())\n", (double)(get_ns - base) / iters);
+    return 0;
+}
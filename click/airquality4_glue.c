@@ -7,6 +7,7 @@ static uint32_t numsamples;
 static env_reading_t eco2;
 static env_reading_t tvoc;
 static uint8_t hum_comp[3];
+static jd_coro_t measure_co;
 
 static uint8_t crc8(const uint8_t *data, int len) {
     uint8_t res = 0xff;
@@ -49,24 +50,40 @@ static void aq4_set_temp_humidity(int32_t temp, int32_t humidity) {
     hum_comp[2] = crc8(hum_comp, 2);
 }
 
-static void aq4_process(void) {
-    if (jd_should_sample(&nextsample, 1000000)) {
-        if (hum_comp[0] || hum_comp[1]) {
-            i2c_write_reg16_buf(0x58, 0x2061, hum_comp, 3);
-            jd_services_sleep_us(10000);
-        }
+// a measurement, with humidity compensation; the sensor needs 10ms after each command
+static int aq4_measure(void) {
+    JD_CORO_BEGIN(&measure_co);
 
-        uint16_t vals[2];
-        air_quality4_get_co2_and_tvoc(&ctx, vals);
+    if (hum_comp[0] || hum_comp[1]) {
+        i2c_write_reg16_buf(0x58, 0x2061, hum_comp, 3);
+        JD_CORO_SLEEP_US(&measure_co, 10000);
+    }
 
-        numsamples++;
+    // same as air_quality4_get_co2_and_tvoc(), without blocking in transfer_delay()
+    static const uint8_t measure_iaq[2] = {0x20, 0x08};
+    i2c_master_write(&ctx.i2c, measure_iaq, 2);
+    JD_CORO_SLEEP_US(&measure_co, 10000);
 
-        eco2.value = vals[0] << 10;
-        eco2.error = vals[0] << 6; // just a wild guess
+    uint8_t read_air[6];
+    i2c_master_read(&ctx.i2c, read_air, 6);
+    uint16_t vals[2] = {(read_air[0] << 8) | read_air[1], (read_air[3] << 8) | read_air[4]};
 
-        tvoc.value = vals[1] << 10;
-        tvoc.error = vals[1] << 6; // just a wild guess
-    }
+    numsamples++;
+
+    eco2.value = vals[0] << 10;
+    eco2.error = vals[0] << 6; // just a wild guess
+
+    tvoc.value = vals[1] << 10;
+    tvoc.error = vals[1] << 6; // just a wild guess
+
+    JD_CORO_END(&measure_co);
+}
+
+static void aq4_process(void) {
+    if (!measure_co.line && !jd_should_sample(&nextsample, 1000000))
+        return;
+    if (aq4_measure() == JD_CORO_WAITING)
+        jd_services_wake_at(NULL, measure_co.wake);
 }
 
 static void aq4_sleep(void) {
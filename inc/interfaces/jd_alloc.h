@@ -29,11 +29,40 @@ uint32_t jd_available_memory(void);
 /**
  *  Any corresponding free calls made by the jacdac-c library will use this function.
  * 
- *  Note: this is never used.
+ *  Note: simple_alloc.c ignores it; link pool_alloc.c instead to get the memory back.
  **/
 void jd_free(void* ptr);
 
+typedef struct {
+    uint32_t heap_size;
+    uint32_t in_use;        // bytes asked for by live allocations
+    uint32_t max_in_use;
+    uint32_t in_blocks;     // bytes taken by live allocations, with headers and rounding
+    uint32_t in_free_lists; // freed blocks; only reused for allocations of the same size class
+    uint32_t never_used;    // good for an allocation of any size (see jd_available_memory())
+    uint32_t num_alloc;
+    uint32_t num_free;
+    uint32_t max_stack; // deepest stack seen by jd_alloc_stack_check() (0 if not known)
+} jd_alloc_stats_t;
+
+/**
+ * Memory usage of the allocator. Internal fragmentation is in_blocks - in_use,
+ * external fragmentation in_free_lists / (in_free_lists + never_used).
+ */
+jd_alloc_stats_t *jd_alloc_get_stats(void);
+
 void jd_alloc_stack_check(void);
 void *jd_alloc_emergency_area(uint32_t size);
 
+/**
+ * With JD_CONFIG_ALLOC_TAGS, allocators call jd_alloc_tag_charge() with the size of every block
+ * they hand out (headers and rounding included), and keep the returned tag with the block;
+ * jd_alloc_tag_release() is called when the block is freed (if the memory is really given back).
+ * The tag is the index of the service that is running, or JD_ALLOC_TAG_NONE; these are implemented
+ * by the service framework.
+ */
+#define JD_ALLOC_TAG_NONE 0xff
+uint8_t jd_alloc_tag_charge(uint32_t size);
+void jd_alloc_tag_release(uint8_t tag, uint32_t size);
+
 #endif
\ No newline at end of file
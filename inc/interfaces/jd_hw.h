@@ -55,6 +55,15 @@ void uart_flush_rx(void);
 uint16_t adc_read_temp(void);
 #endif
 
+#if JD_CONFIG_CRC_HW == 1
+// CRC-16/CCITT-FALSE peripheral, continuing from 'crc' (0xffff for a new computation)
+// crc_hw_start() may return before the computation is done (e.g., when it uses DMA);
+// crc_hw_complete() waits for it, and returns the result
+// these are never called again before crc_hw_complete() returns
+void crc_hw_start(uint16_t crc, const void *data, uint32_t size);
+uint16_t crc_hw_complete(void);
+#endif
+
 // Things below are only required by drivers/*.c
 
 // i2c.c
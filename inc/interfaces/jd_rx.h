@@ -10,5 +10,10 @@
 #include "jd_service_framework.h"
 
 void jd_rx_init(void);
+// bridge between phys and queue imp, phys receives the next frame into this buffer
+jd_frame_t *jd_rx_get_free_frame(void);
+// phys hands over the buffer from jd_rx_get_free_frame(); returns -1 if the queue is full
 int jd_rx_frame_received(jd_frame_t *frame);
-jd_frame_t* jd_rx_get_frame(void);
\ No newline at end of file
+// next frame to process in the main loop (or NULL); it stays valid until released
+jd_frame_t *jd_rx_get_frame(void);
+void jd_rx_release_frame(jd_frame_t *frame);
\ No newline at end of file
@@ -9,14 +9,39 @@
 
 #include "jd_service_framework.h"
 
+// priority classes of outgoing packets, most urgent first; see tx_queue.c
+#define JD_TX_CLASS_URGENT 0    // CRC ACKs, events, announce
+#define JD_TX_CLASS_RESPONSE 1  // register and command responses, everything else
+#define JD_TX_CLASS_STREAMING 2 // readings (JD_GET(JD_REG_READING))
+#define JD_TX_NUM_CLASSES 3
+
+typedef struct {
+    uint16_t depth;     // frames waiting to be sent, as of last jd_tx_flush()
+    uint16_t max_depth; // most frames waiting at once
+    uint32_t packets_queued;
+    uint32_t packets_dropped; // no room in the queue, or pushed out by a more urgent class
+    uint32_t bytes_copied;    // payload copied by jd_send(), as opposed to jd_send_reserve()
+} jd_tx_class_stats_t;
+
 void jd_tx_init(void);
 void jd_tx_flush(void);
 int jd_tx_is_idle(void);
 jd_frame_t *jd_tx_get_frame(void);
 void jd_tx_frame_sent(jd_frame_t *frame);
+// array of JD_TX_NUM_CLASSES entries
+jd_tx_class_stats_t *jd_tx_get_stats(void);
 
 int jd_send(unsigned service_num, unsigned service_cmd, const void *data, unsigned service_size);
 
+/**
+ * Zero-copy version of jd_send(): returns a pointer to 'service_size' bytes in the outgoing frame
+ * (or NULL, when there is no room), which the caller fills in, and then calls jd_send_commit(),
+ * or jd_send_abort() to drop the packet. Nothing else can be sent in between.
+ */
+void *jd_send_reserve(unsigned service_num, unsigned service_cmd, unsigned service_size);
+void jd_send_commit(void);
+void jd_send_abort(void);
+
 // wrappers around jd_send()
 int jd_respond_u8(jd_packet_t *pkt, uint8_t v);
 int jd_respond_u16(jd_packet_t *pkt, uint16_t v);
@@ -29,12 +54,63 @@ int jd_send_not_implemented(jd_packet_t *pkt);
  */
 int jd_block_register(jd_packet_t *pkt, uint16_t reg_code);
 
+/**
+ * Marks the frame with the last packet sent with JD_FRAME_FLAG_ACK_REQUESTED.
+ * Only makes sense for commands, or with JD_CONFIG_EVENT_ACK.
+ */
+void jd_tx_request_ack(void);
+
 void jd_send_event_ext(srv_t *srv, uint32_t eventid, const void *data, uint32_t data_bytes);
 static inline void jd_send_event(srv_t *srv, uint32_t eventid) {
     jd_send_event_ext(srv, eventid, 0, 0);
 }
 void jd_process_event_queue(void);
 
+typedef struct {
+    uint8_t retransmits;  // at most JD_EVENT_MAX_RETRANSMITS
+    uint8_t ack;          // with JD_CONFIG_EVENT_ACK, stop re-transmitting once ACKed
+    uint16_t first_ms;    // delay of the first re-transmission
+    uint16_t interval_ms; // between the following ones
+} jd_event_policy_t;
+#define JD_EVENT_MAX_RETRANSMITS 3
+
+/**
+ * Sets how events of 'srv' are re-transmitted; 'policy' is not copied (typically static const).
+ * Services without a policy use JD_EVENT_RETRANSMITS and friends.
+ */
+void jd_event_set_policy(srv_t *srv, const jd_event_policy_t *policy);
+
+typedef struct {
+    uint8_t code;      // event code
+    uint8_t group;     // a later event of the same group (non-zero) replaces a pending one...
+    uint8_t key_bytes; // ...if the first 'key_bytes' of their data match (like a pin number)
+} jd_event_coalesce_t;
+
+/**
+ * With JD_CONFIG_EVENT_COALESCE, events of 'srv' with codes in 'rules' are held back until the end
+ * of the tick; if there is more than one by then, they are sent (and re-transmitted) together
+ * in a single JD_EV_BATCH event, which carries them one after another as: data size (1 byte),
+ * event code (1 byte), data. Other events of 'srv' go out after the ones held back.
+ * Only for state events should 'group' be set - a superseded event is never sent.
+ * 'rules' is not copied; without JD_CONFIG_EVENT_COALESCE this does nothing.
+ */
+void jd_event_set_coalesce(srv_t *srv, const jd_event_coalesce_t *rules, unsigned num_rules);
+
+typedef struct {
+    uint32_t events;
+    uint32_t batches;    // JD_EV_BATCH events sent (JD_CONFIG_EVENT_COALESCE)
+    uint32_t superseded; // events replaced by a later one of the same group before being sent
+    uint32_t retransmits;
+    uint32_t retransmits_acked;   // not sent, because the event was ACKed (JD_CONFIG_EVENT_ACK)
+    uint32_t retransmits_dropped; // not sent, because the queue was full
+} jd_event_stats_t;
+jd_event_stats_t *jd_event_get_stats(void);
+
+// called by the TX queue for frames with JD_FRAME_FLAG_ACK_REQUESTED, once the CRC is known
+void jd_event_frame_sealed(jd_frame_t *frame);
+// called when a CRC ACK comes
+void jd_event_ack_received(uint16_t crc);
+
 #if JD_RAW_FRAME
 extern uint8_t rawFrameSending;
 extern jd_frame_t *rawFrame;
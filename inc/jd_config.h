@@ -58,8 +58,30 @@
 #define JD_CONFIG_DEV_SPEC_URL 0
 #endif
 
+// lay out service states one after another in a static block of JD_CONFIG_SERVICE_ARENA_SIZE
+// bytes, and keep the per-service tables in static arrays of JD_CONFIG_MAX_SERVICES entries,
+// instead of allocating them in jd_services_init(); both sizes have to fit the application
+#ifndef JD_CONFIG_STATIC_SERVICES
+#define JD_CONFIG_STATIC_SERVICES 0
+#endif
+#ifndef JD_CONFIG_MAX_SERVICES
+#define JD_CONFIG_MAX_SERVICES 32
+#endif
+#ifndef JD_CONFIG_SERVICE_ARENA_SIZE
+#define JD_CONFIG_SERVICE_ARENA_SIZE 1024
+#endif
+
+// answer announce requests (JD_CONTROL_CMD_SERVICES) right in the RX IRQ, with a frame
+// preformatted in jd_services_init(); it goes out through the raw frame slot (JD_RAW_FRAME)
+#ifndef JD_CONFIG_ANNOUNCE_IRQ
+#define JD_CONFIG_ANNOUNCE_IRQ 0
+#endif
+
 #ifndef JD_RAW_FRAME
-#define JD_RAW_FRAME 0
+#define JD_RAW_FRAME JD_CONFIG_ANNOUNCE_IRQ
+#endif
+#if JD_CONFIG_ANNOUNCE_IRQ == 1 && !JD_RAW_FRAME
+#error "JD_CONFIG_ANNOUNCE_IRQ requires JD_RAW_FRAME"
 #endif
 
 #define CONCAT_1(a, b) a##b
@@ -68,10 +90,134 @@
 #define STATIC_ASSERT(e) enum { CONCAT_0(_static_assert_, __LINE__) = 1 / ((e) ? 1 : 0) };
 #endif
 
+// implementation of jd_crc16(), trading flash for speed:
+// bit-twiddling (no table), 16-entry table (32 bytes), 256-entry table (512 bytes),
+// or slice-by-4 (2k of tables, processes 4 bytes per step)
+#define JD_CRC16_BITWISE 0
+#define JD_CRC16_NIBBLE 1
+#define JD_CRC16_TABLE 2
+#define JD_CRC16_SLICE4 3
+#ifndef JD_CONFIG_CRC16
+#define JD_CONFIG_CRC16 JD_CRC16_BITWISE
+#endif
+
+// use the CRC peripheral (crc_hw_*() in jd_hw.h) for jd_crc16()
+#ifndef JD_CONFIG_CRC_HW
+#define JD_CONFIG_CRC_HW 0
+#endif
+
+// number of frame buffers for reception; one is always being received into
+#ifndef JD_RX_QUEUE_SIZE
+#define JD_RX_QUEUE_SIZE 3
+#endif
+
+// number of frame buffers for transmission, shared between priority classes
+#ifndef JD_TX_QUEUE_SIZE
+#define JD_TX_QUEUE_SIZE 4
+#endif
+
+// how long to wait before (re)trying to transmit, after the bus goes idle:
+// a fixed ~150us (randomized), or a window that doubles with every lost arbitration
+// (the line already taken when starting TX, or someone else starting first) - at most once
+// per frame - and halves with every frame sent without losing one, up to JD_TX_BACKOFF_MAX_EXP
+// doublings
+#define JD_TX_BACKOFF_FIXED 0
+#define JD_TX_BACKOFF_ADAPTIVE 1
+#ifndef JD_CONFIG_TX_BACKOFF
+#define JD_CONFIG_TX_BACKOFF JD_TX_BACKOFF_FIXED
+#endif
+
+#ifndef JD_TX_BACKOFF_MAX_EXP
+#define JD_TX_BACKOFF_MAX_EXP 4
+#endif
+
+// with JD_TX_BACKOFF_ADAPTIVE, the window also halves every that many us it doesn't double
+#ifndef JD_TX_BACKOFF_DECAY_US
+#define JD_TX_BACKOFF_DECAY_US 10000
+#endif
+
+// look up registers in a per-REG_DEFINITION() table sorted by code, instead of walking the
+// definition on every GET/SET; tables are built in service init, by service_index_registers()
+// (services with many registers call it: ledpixel, joystick, speech synthesis) and
+// service_notify_registers() - other definitions are still walked
+// off by default, as it costs RAM that existing firmware didn't budget for: 8 bytes per register
+// of indexed definitions, plus a pointer per service (JD_CONFIG_MAX_SERVICES), all allocated in
+// init; a SET goes from ~75ns to ~45ns (bench_reg, 24 registers), which matters for hosts polling
+// registers at high rates, not for occasional GETs
+#ifndef JD_CONFIG_REG_INDEX
+#define JD_CONFIG_REG_INDEX 0
+#endif
+
+// drop received frames in the RX interrupt, before they take up the RX queue and reach
+// the main loop (they are counted as packets_filtered in jd_diagnostics_t); filtered frames
+// are not seen by jd_app_handle_packet() either, so don't filter what the app listens to
+#define JD_RX_FILTER_COMMANDS 0x01   // commands for other devices
+#define JD_RX_FILTER_BROADCASTS 0x02 // commands for service classes that we don't have
+#define JD_RX_FILTER_REPORTS 0x04    // reports from other devices, except for control service
+#ifndef JD_CONFIG_RX_FILTER
+#define JD_CONFIG_RX_FILTER 0
+#endif
+
+// time bus activity, TX queue wait and RX dispatch latency into jd_diagnostics_t
+// (costs a tim_get_micros() call per frame in IRQ and in the main loop)
+#ifndef JD_CONFIG_BUS_STATS
+#define JD_CONFIG_BUS_STATS 0
+#endif
+
+// count calls and time of process() and handle_pkt() of every service (jd_service_profile_t),
+// for JD_CONTROL_CMD_SERVICE_PROFILE; time is in ticks of JD_PROFILE_CLOCK(), which a board
+// can point at a cycle counter (costs two clock reads per call)
+#ifndef JD_CONFIG_SERVICE_PROFILE
+#define JD_CONFIG_SERVICE_PROFILE 0
+#endif
+#ifndef JD_PROFILE_CLOCK
+#define JD_PROFILE_CLOCK() ((uint32_t)tim_get_micros())
+#endif
+
+// charge every heap block to the service that allocated it (in its init, process() or
+// handle_pkt()), for JD_CONTROL_REG_HEAP_USAGE; costs 8 bytes of RAM per service, and with
+// pool_alloc.c 4 more bytes per block
+#ifndef JD_CONFIG_ALLOC_TAGS
+#define JD_CONFIG_ALLOC_TAGS 0
+#endif
+
 #ifndef JD_EVENT_QUEUE_SIZE
 #define JD_EVENT_QUEUE_SIZE 128
 #endif
 
+// events are sent right away, and re-transmitted JD_EVENT_RETRANSMITS times (at most 3): first
+// after JD_EVENT_RETRANSMIT_FIRST_MS, then every JD_EVENT_RETRANSMIT_INTERVAL_MS; a service
+// can set its own jd_event_policy_t
+#ifndef JD_EVENT_RETRANSMITS
+#define JD_EVENT_RETRANSMITS 2
+#endif
+#ifndef JD_EVENT_RETRANSMIT_FIRST_MS
+#define JD_EVENT_RETRANSMIT_FIRST_MS 20
+#endif
+#ifndef JD_EVENT_RETRANSMIT_INTERVAL_MS
+#define JD_EVENT_RETRANSMIT_INTERVAL_MS 50
+#endif
+
+// let jd_event_policy_t 'ack' request a CRC ACK for frames with events; an ACK cancels the
+// remaining re-transmissions of the events in the frame, if it's among the last
+// JD_EVENT_ACK_SLOTS events sent in such frames
+#ifndef JD_CONFIG_EVENT_ACK
+#define JD_CONFIG_EVENT_ACK 0
+#endif
+#ifndef JD_EVENT_ACK_SLOTS
+#define JD_EVENT_ACK_SLOTS 16
+#endif
+
+// let services hold back events listed with jd_event_set_coalesce() until the end of the tick,
+// and send the ones raised in the same tick as a single JD_EV_BATCH event (not part of the spec,
+// so clients have to know about it); JD_EVENT_COALESCE_SIZE bytes of events can be held back
+#ifndef JD_CONFIG_EVENT_COALESCE
+#define JD_CONFIG_EVENT_COALESCE 0
+#endif
+#ifndef JD_EVENT_COALESCE_SIZE
+#define JD_EVENT_COALESCE_SIZE 64
+#endif
+
 #ifndef JD_TIM_OVERHEAD
 #define JD_TIM_OVERHEAD 12
 #endif
@@ -14,6 +14,28 @@
 
 #define JD_ADVERTISEMENT_0_COUNTER_MASK 0x0000000F
 
+// not part of the spec; jd_diagnostics_t, so that a host can poll the bus health of all devices
+#define JD_CONTROL_REG_BUS_DIAGNOSTICS 0x190
+// not part of the spec; with JD_CONFIG_SERVICE_PROFILE, reports jd_service_profile_t of services
+// request: u8 first service index, u8 flags (optional); reset all profiles after reporting with
+// JD_CONTROL_SERVICE_PROFILE_RESET
+// report: u8 first service index, u8 number of services, u16 reserved, then the profiles starting
+// with the first service, as many as fit in a packet
+#define JD_CONTROL_CMD_SERVICE_PROFILE 0x190
+#define JD_CONTROL_SERVICE_PROFILE_RESET 0x01
+// not part of the spec; jd_control_heap_usage_t, followed (with JD_CONFIG_ALLOC_TAGS) by
+// u16 in use, u16 max in use (jd_service_heap_t, capped at 0xffff) of every service
+#define JD_CONTROL_REG_HEAP_USAGE 0x191
+
+typedef struct {
+    uint32_t heap_size;
+    uint32_t in_use; // bytes asked for by live allocations (jd_alloc_stats_t)
+    uint32_t max_in_use;
+    uint32_t available; // left for an allocation of any size
+    uint16_t max_stack; // deepest stack seen (0 if not known)
+    uint16_t num_services;
+} jd_control_heap_usage_t;
+
 #define JD_GET(reg) (JD_CMD_GET_REGISTER | (reg))
 #define JD_SET(reg) (JD_CMD_SET_REGISTER | (reg))
 
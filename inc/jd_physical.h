@@ -91,9 +91,18 @@ void jd_compute_crc(jd_frame_t *frame);
 void jd_tx_completed(int errCode);
 void jd_rx_completed(int dataLeft);
 void jd_line_falling(void);
+// optional; can be called by uart implementation while a frame is still being received
+// (e.g., on DMA half-transfer), with the number of bytes received so far (already in RAM);
+// the CRC of these is then computed upfront, and jd_rx_completed() only does the remaining bytes
+// has to be called from the same IRQ level as jd_rx_completed()
+void jd_rx_data_received(uint32_t numbytes);
 int jd_is_running(void);
 int jd_is_busy(void);
 
+// latency histograms in jd_diagnostics_t: bucket 0 counts values below 128us, bucket i
+// values in [64us << i, 128us << i), and the last bucket everything above
+#define JD_DIAG_HIST_BUCKETS 10
+
 typedef struct {
     uint32_t bus_state;
     uint32_t bus_lo_error;
@@ -101,9 +110,22 @@ typedef struct {
     uint32_t bus_timeout_error;
     uint32_t packets_sent;
     uint32_t packets_received;
-    uint32_t packets_dropped;
+    uint32_t packets_dropped;     // frames of a newer protocol version (JD_FRAME_FLAG_VNEXT)
+    uint32_t rx_queue_high_water; // most frames waiting for the main loop at once
+    uint32_t rx_queue_overflow;   // frames dropped because the RX queue was full
+    uint32_t packets_filtered;    // frames dropped by JD_CONFIG_RX_FILTER
+    // the fields below are only updated with JD_CONFIG_BUS_STATS
+    uint32_t bus_rx_us;             // total time spent receiving frames
+    uint32_t bus_tx_us;             // total time spent transmitting frames
+    uint32_t irq_disabled_max_ns;   // longest IRQ-disabled section reported by the HAL
+    uint16_t tx_wait_hist[JD_DIAG_HIST_BUCKETS]; // frame queued -> transmission completed
+    uint16_t rx_dispatch_hist[JD_DIAG_HIST_BUCKETS]; // frame received -> handed to services
 } jd_diagnostics_t;
 jd_diagnostics_t *jd_get_diagnostics(void);
+// adds a latency (in us) to one of the histograms in jd_diagnostics_t
+void jd_diagnostics_hist_add(uint16_t *hist, uint32_t us);
+// optional; to be called by the HAL when leaving its outermost IRQ-disabled section
+void jd_diagnostics_irq_section(uint32_t ns);
 
 #ifdef __cplusplus
 }
@@ -14,6 +14,14 @@
 #define JD_REG_PADDING 0xff0
 #define JD_REG_END 0xff1
 #define JD_REG_SERVICE_DISABLED 0xff2
+#define JD_REG_NOTIFY 0xff3
+// not part of the spec; see jd_services_handle_packet()
+#define JD_CMD_REGISTER_BATCH 0xff0
+// not part of the spec; see service_notify_registers()
+#define JD_CMD_REGISTERS_CHANGED 0xff1
+// not part of the spec; event code, see jd_event_set_coalesce()
+#define JD_EV_BATCH 0xff
+
 #define _REG_(tp, v) (((tp) << 12) | (v))
 #define _REG_I8 0
 #define _REG_U8 1
@@ -41,6 +49,8 @@
 #define REG_BYTE8(v) _REG_(_REG_BYTE8, (v))
 #define REG_BIT(v) _REG_(_REG_BIT, (v))
 #define REG_BYTES(v, n) _REG_(_REG_BYTES, (v)), n
+// the framework reports the register whenever it changes, see service_notify_registers()
+#define REG_NOTIFY(r) JD_REG_NOTIFY, r
 
 #define REG_DEFINITION(name, ...) static const uint16_t name[] = {__VA_ARGS__ JD_REG_END};
 
@@ -88,6 +98,53 @@ int service_handle_register(srv_t *state, jd_packet_t *pkt, const uint16_t sdesc
  */
 int service_handle_register_final(srv_t *state, jd_packet_t *pkt, const uint16_t sdesc[]);
 
+/**
+ * Makes the framework watch registers marked with REG_NOTIFY() in 'sdesc'. Once per
+ * jd_services_tick(), after all process() callbacks, the ones that changed are reported in a single
+ * JD_CMD_REGISTERS_CHANGED packet, in the JD_CMD_REGISTER_BATCH format (i.e., as GET responses).
+ * Typically called in service init, after SRV_ALLOC().
+ */
+void service_notify_registers(srv_t *state, const uint16_t sdesc[]);
+
+/**
+ * With JD_CONFIG_REG_INDEX, makes service_handle_register() look up registers of 'sdesc' for
+ * 'state' in a table sorted by code (service_notify_registers() does it as well). Call it in
+ * service init, after SRV_ALLOC() - the table is allocated (once for all services with the same
+ * 'sdesc'), and never freed. Other definitions passed for 'state' are still walked.
+ */
+void service_index_registers(srv_t *state, const uint16_t sdesc[]);
+
+typedef struct {
+    uint32_t calls;
+    uint32_t time;     // total, in JD_PROFILE_CLOCK() ticks
+    uint32_t max_time; // of a single call
+} jd_profile_counter_t;
+
+typedef struct {
+    jd_profile_counter_t process;
+    jd_profile_counter_t packet; // handle_pkt()
+} jd_service_profile_t;
+
+/**
+ * With JD_CONFIG_SERVICE_PROFILE, returns the profile of the given service (time spent in
+ * process() includes any nested jd_process_everything() from jd_services_sleep_us()).
+ * Returns NULL if there is no such service, or profiling is disabled.
+ */
+jd_service_profile_t *jd_services_profile(unsigned service_index);
+
+typedef struct {
+    uint32_t in_use; // bytes of heap blocks charged to the service (headers and rounding included)
+    uint32_t max_in_use;
+} jd_service_heap_t;
+
+/**
+ * With JD_CONFIG_ALLOC_TAGS, returns the heap usage of the given service: allocations made in its
+ * init (from jd_allocate_service() on, state included), process() and handle_pkt().
+ * With simple_alloc.c nothing is freed, so in_use only goes up.
+ * Returns NULL if there is no such service, or the accounting is disabled.
+ */
+jd_service_heap_t *jd_services_heap(unsigned service_index);
+
 /**
  * called by jd_init();
  **/
@@ -104,6 +161,97 @@ void jd_services_tick(void);
  */
 void jd_process_everything(void);
 
+/**
+ * Scheduling hints, called from process() of the service 'state'; they only last until the next
+ * process() call. Without a hint, process() is called on every jd_services_tick().
+ * With jd_services_wake_at(), process() is skipped until 'when' (if called several times, the
+ * earliest 'when' counts); with jd_services_wake_on_packet(), until a packet comes for the service.
+ * A packet for the service always makes process() run on the following tick.
+ * With 'state' NULL, jd_services_wake_at() asks for the next tick to happen by 'when', without
+ * affecting any service - use it from app_process() or other code outside of services.
+ */
+void jd_services_wake_at(srv_t *state, uint32_t when);
+void jd_services_wake_on_packet(srv_t *state);
+
+/**
+ * How long (in us) the platform can sleep before calling jd_process_everything() again,
+ * unless an interrupt comes first; computed on the last jd_services_tick().
+ * Services without a hint don't count - as before, they run whenever the platform wakes up
+ * (at least on the physical layer's 10ms tick, or as often as tim_max_sleep says).
+ */
+uint32_t jd_services_max_sleep(void);
+
+/**
+ * Stackless coroutines, for code in process() that has to wait (e.g., for a sensor to finish
+ * a measurement), without blocking other services like jd_services_sleep_us() does.
+ * The body of a coroutine function is enclosed in JD_CORO_BEGIN() and JD_CORO_END(); the function
+ * returns JD_CORO_WAITING when it yields, and resumes after the yield point on the next call.
+ * Local variables are not preserved across yields - keep them in the service state; also,
+ * the body can't contain 'switch' statements (the resume point is a 'case' label).
+ * When a coroutine yields, process() should pass 'wake' to jd_services_wake_at().
+ */
+typedef struct {
+    uint16_t line;
+    uint32_t wake;
+} jd_coro_t;
+
+#define JD_CORO_WAITING 0
+#define JD_CORO_DONE 1
+
+// the resume points fall through into their 'case' on purpose (a comment would not survive
+// macro expansion, so -Wimplicit-fallthrough needs the attribute)
+#if defined(__has_attribute)
+#if __has_attribute(fallthrough)
+#define JD_CORO_FALLTHROUGH __attribute__((fallthrough))
+#endif
+#endif
+#ifndef JD_CORO_FALLTHROUGH
+#define JD_CORO_FALLTHROUGH ((void)0)
+#endif
+
+#define JD_CORO_BEGIN(co)                                                                          \
+    switch ((co)->line) {                                                                          \
+    case 0:
+#define JD_CORO_END(co)                                                                            \
+    }                                                                                              \
+    (co)->line = 0;                                                                                \
+    return JD_CORO_DONE
+
+// yields until 'us' microseconds have passed
+#define JD_CORO_SLEEP_US(co, us)                                                                   \
+    do {                                                                                           \
+        (co)->wake = now + (us);                                                                   \
+        (co)->line = __LINE__;                                                                     \
+        JD_CORO_FALLTHROUGH;                                                                       \
+    case __LINE__:                                                                                 \
+        if (in_future((co)->wake))                                                                 \
+            return JD_CORO_WAITING;                                                                \
+    } while (0)
+
+// yields until 'cond' holds; it is checked on every tick
+#define JD_CORO_WAIT_UNTIL(co, cond)                                                               \
+    do {                                                                                           \
+        (co)->line = __LINE__;                                                                     \
+        JD_CORO_FALLTHROUGH;                                                                       \
+    case __LINE__:                                                                                 \
+        if (!(cond)) {                                                                             \
+            (co)->wake = now;                                                                      \
+            return JD_CORO_WAITING;                                                                \
+        }                                                                                          \
+    } while (0)
+
+// runs 'call', a nested coroutine with its own state 'sub', until it's done
+#define JD_CORO_AWAIT(co, sub, call)                                                               \
+    do {                                                                                           \
+        (co)->line = __LINE__;                                                                     \
+        JD_CORO_FALLTHROUGH;                                                                       \
+    case __LINE__:                                                                                 \
+        if ((call) == JD_CORO_WAITING) {                                                           \
+            (co)->wake = (sub)->wake;                                                              \
+            return JD_CORO_WAITING;                                                                \
+        }                                                                                          \
+    } while (0)
+
 /**
  * Can be implemented by the user to get a callback on each packet.
  */
@@ -122,10 +270,27 @@ void jd_app_handle_command(jd_packet_t *pkt);
  **/
 void jd_services_process_frame(jd_frame_t *frame);
 
+/**
+ * Called by the physical layer (in IRQ) with JD_CONFIG_RX_FILTER; returns 0 if the frame
+ * is of no interest to this device.
+ **/
+int jd_services_wants_frame(jd_frame_t *frame);
+
+/**
+ * With JD_CONFIG_ANNOUNCE_IRQ, called by the physical layer (in IRQ); if the frame is just
+ * an announce request for this device, queues the announce and returns 1 (the frame is not
+ * processed further - jd_app_handle_command() doesn't see it).
+ **/
+int jd_services_announce_irq(jd_frame_t *frame);
+
 /**
  * invoked by jd_services_process_frame.
  *
  * Handles the routing of packets to services.
+ * A JD_CMD_REGISTER_BATCH command carries a list of packets in frame format (size, service index
+ * - ignored, command, data padded to 4 bytes), typically register GETs and SETs; these are
+ * handed to the service one by one, as if they arrived separately, and the responses end up
+ * in a single frame. Only honored for commands addressed to this device.
  **/
 void jd_services_handle_packet(jd_packet_t *pkt);
 
@@ -138,6 +303,8 @@ void jd_services_announce(void);
 
 /**
  * Called by TX queue implementation when a packet is queued for sending.
+ * Only from the main loop - with JD_CONFIG_ANNOUNCE_IRQ the counter is shared with the RX IRQ,
+ * and it disables IRQs around the update.
  */
 void jd_services_packet_queued(void);
 
@@ -147,6 +314,7 @@ void jd_services_packet_queued(void);
  * process callbacks that are currently sleeping.
  * This will also prevent the MCU from sleeping.
  * Be mindful of stack usage.
+ * Other services don't run in the meantime - prefer a coroutine with JD_CORO_SLEEP_US().
  */
 void jd_services_sleep_us(uint32_t delta);
 
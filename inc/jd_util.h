@@ -13,6 +13,14 @@ uint32_t jd_random(void);
 void jd_seed_random(uint32_t s);
 uint32_t jd_hash_fnv1a(const void *data, unsigned len);
 uint16_t jd_crc16(const void *data, uint32_t size);
+// incremental jd_crc16(): init, then update with consecutive chunks of data, then final
+static inline uint16_t jd_crc16_init(void) {
+    return 0xffff;
+}
+uint16_t jd_crc16_update(uint16_t crc, const void *data, uint32_t size);
+static inline uint16_t jd_crc16_final(uint16_t crc) {
+    return crc; // no final XOR in CRC-16/CCITT-FALSE
+}
 int jd_shift_frame(jd_frame_t *frame);
 void jd_reset_frame(jd_frame_t *frame);
 void *jd_push_in_frame(jd_frame_t *frame, unsigned service_num, unsigned service_cmd,
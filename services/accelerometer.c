@@ -238,8 +238,21 @@ void accelerometer_handle_packet(srv_t *state, jd_packet_t *pkt) {
 }
 
 SRV_DEF(accelerometer, JD_SERVICE_CLASS_ACCELEROMETER);
+
+// force events often come several in one sample; only the latest posture matters
+// (freefall is one-shot, like shake and force - never superseded)
+static const jd_event_coalesce_t accelerometer_coalesce[] = {
+    {JD_ACCELEROMETER_EV_TILT_UP, 1, 0},   {JD_ACCELEROMETER_EV_TILT_DOWN, 1, 0},
+    {JD_ACCELEROMETER_EV_TILT_LEFT, 1, 0}, {JD_ACCELEROMETER_EV_TILT_RIGHT, 1, 0},
+    {JD_ACCELEROMETER_EV_FACE_UP, 1, 0},   {JD_ACCELEROMETER_EV_FACE_DOWN, 1, 0},
+    {JD_ACCELEROMETER_EV_FREEFALL, 0, 0},  {JD_ACCELEROMETER_EV_SHAKE, 0, 0},
+    {JD_ACCELEROMETER_EV_FORCE_2G, 0, 0},  {JD_ACCELEROMETER_EV_FORCE_3G, 0, 0},
+    {JD_ACCELEROMETER_EV_FORCE_6G, 0, 0},  {JD_ACCELEROMETER_EV_FORCE_8G, 0, 0},
+};
 void accelerometer_init(const accelerometer_api_t *api) {
     SRV_ALLOC(accelerometer);
+    jd_event_set_coalesce(state, accelerometer_coalesce,
+                          sizeof(accelerometer_coalesce) / sizeof(accelerometer_coalesce[0]));
     state->api = api;
 #ifdef PIN_ACC_INT
     pin_setup_input(PIN_ACC_INT, PIN_PULL_DOWN);
@@ -49,6 +49,7 @@ struct srv_state {
     char string[60];
     uint8_t flags;
     const uint8_t* cell_map;
+    br_ctx_t br;
 };
 
 REG_DEFINITION(                                   //
@@ -146,7 +147,10 @@ static void update_bitmask(srv_t * state) {
 
 void braille_char_process(srv_t * state) {
     if (state->flags & STATE_DIRTY) {
-        BrRfshPtn(state->api);
+        if (BrRfshPtn(&state->br, state->api) == JD_CORO_WAITING) {
+            jd_services_wake_at(state, state->br.co.wake);
+            return;
+        }
         state->flags &= ~STATE_DIRTY;
     }
 
@@ -154,6 +158,9 @@ void braille_char_process(srv_t * state) {
         update_bitmask(state);
         state->flags &= ~STATE_UPD_PENDING;
     }
+
+    if (!state->flags)
+        jd_services_wake_on_packet(state);
 }
 
 void handle_disp_write(srv_t * state, jd_packet_t* pkt) {
@@ -205,8 +212,7 @@ void braille_char_init(const hbridge_api_t *params, uint16_t rows, uint16_t cols
 
     state->api->init();
 
+    // the first process() clears all dots
     BrClrPtn();
-
-    BrClrAllDots(state->api);
-    target_wait_us(3000);
+    state->flags = STATE_DIRTY;
 }
\ No newline at end of file
@@ -55,9 +55,8 @@ const uint16_t BrDotTbl_forced[ MAXBRPHASE ][ MAXBRROW ][ MAXBRCOL ][ MAXBRBANK
 };
 
 
-static void delay(uint32_t t) {
-    jd_services_sleep_us(t * 1000);
-}
+// yields from the coroutine 'co' for 't' milliseconds
+#define delay(co, t) JD_CORO_SLEEP_US(co, (t)*1000)
 
 // Braille
 bool BrDotPtn[MAXBRROW][MAXBRCOL] = {false};
@@ -92,85 +91,46 @@ void BrSetPtn(uint16_t row, uint16_t col, bool state) {
     BrDotPtn[row][col] = state;
 }
 
-// BrRfshPtn: Refresh and load new braille pattern
-void BrRfshPtn(const hbridge_api_t * api) {
-    unsigned char row, col;
-
-    // force clear
-    BrClrAllDots(api);
-
-    // load new pattern
-    for (row = 0; row < MAXBRROW; row++) {
-        for (col = 0; col < MAXBRCOL; col++) {
-            // only set direction
-            if (BrDotPtn[row][col] == true) {
-                BrSetSingleDot(api, row, col, true);
-            }
-        }
-    }
-}
-
-// BrClrAllDots: Clear All Dots (forced)
-void BrClrAllDots(const hbridge_api_t * api) {
-    unsigned char row, col, bk;
-
-    for (row = 0; row < MAXBRROW; row++) {
-        for (col = 0; col < MAXBRCOL; col++) {
-            // reset dot
-            for (bk = 0; bk < MAXBRBANK; bk++) {
-                api->write_raw(BrDotTbl_forced[BRPHASEDN][row][col][bk]);
-            }
-            delay(BRWAITSETFD);
-            // disconnect all cells for pre discharge
-            api->write_raw(0x4001);
-            api->write_raw(0x0001);
-            delay(BRWAITDIS1);
-            // discharge ( all connect to LS )
-            api->write_raw(0x5F81);
-            api->write_raw(0x1F81);
-            delay(BRWAITDIS2);
-            // disconnect all cells
-            api->write_raw(0x4001);
-            api->write_raw(0x0001);
-            delay(BRWAITFHIZ);
-        }
-    }
-}
-
-// BrSetAllDots: Set All Dots (forced)
-void BrSetAllDots(const hbridge_api_t * api) {
-    uint16_t row, col, bk;
+// BrForceAllDots: Set (BRPHASEUP) or Clear (BRPHASEDN) All Dots (forced); runs in ctx->sub
+static int BrForceAllDots(br_ctx_t * ctx, const hbridge_api_t * api, uint8_t ph) {
+    unsigned char bk;
 
-    for (row = 0; row < MAXBRROW; row++) {
-        for (col = 0; col < MAXBRCOL; col++) {
+    JD_CORO_BEGIN(&ctx->sub);
+    for (ctx->row = 0; ctx->row < MAXBRROW; ctx->row++) {
+        for (ctx->col = 0; ctx->col < MAXBRCOL; ctx->col++) {
             // reset dot
             for (bk = 0; bk < MAXBRBANK; bk++) {
-                api->write_raw(BrDotTbl_forced[BRPHASEUP][row][col][bk]);
+                api->write_raw(BrDotTbl_forced[ph][ctx->row][ctx->col][bk]);
             }
-            delay(BRWAITSETFU);
+            if (ph == BRPHASEUP)
+                delay(&ctx->sub, BRWAITSETFU);
+            else
+                delay(&ctx->sub, BRWAITSETFD);
             // disconnect all cells for pre discharge
             api->write_raw(0x4001);
             api->write_raw(0x0001);
-            delay(BRWAITDIS1);
+            delay(&ctx->sub, BRWAITDIS1);
             // discharge ( all connect to LS )
             api->write_raw(0x5F81);
             api->write_raw(0x1F81);
-            delay(BRWAITDIS2);
+            delay(&ctx->sub, BRWAITDIS2);
             // disconnect all cells
             api->write_raw(0x4001);
             api->write_raw(0x0001);
-            delay(BRWAITFHIZ);
+            delay(&ctx->sub, BRWAITFHIZ);
         }
     }
+    JD_CORO_END(&ctx->sub);
 }
 
-// BrSetSingleDot: set single dot (true: set, false: clear): do NOT use directly, may have
-// instability
-void BrSetSingleDot(const hbridge_api_t * api, uint16_t row, uint16_t col, bool set) {
+// BrSetSingleDot: set single dot (true: set, false: clear); runs in ctx->sub
+static int BrSetSingleDot(br_ctx_t * ctx, const hbridge_api_t * api, bool set) {
     uint16_t bk;
     uint8_t ph;
     int delaytime;
 
+    JD_CORO_BEGIN(&ctx->sub);
+
     // set phase
     if (set == true) {
         ph = BRPHASEUP;
@@ -180,7 +140,7 @@ void BrSetSingleDot(const hbridge_api_t * api, uint16_t row, uint16_t col, bool
 
     // set/clr dot
     for (bk = 0; bk < MAXBRBANK; bk++) {
-        api->write_raw(BrDotTbl[ph][row][col][bk]);
+        api->write_raw(BrDotTbl[ph][ctx->row][ctx->col][bk]);
     }
 
     // load delaytime
@@ -198,20 +158,56 @@ void BrSetSingleDot(const hbridge_api_t * api, uint16_t row, uint16_t col, bool
     }
     */
 
-    delay(delaytime);
+    delay(&ctx->sub, delaytime);
 
     // disconnect all cells for pre discharge
     api->write_raw(0x4001);
     api->write_raw(0x0001);
-    delay(BRWAITDIS1);
+    delay(&ctx->sub, BRWAITDIS1);
 
     // discharge ( all connect to LS )
     api->write_raw(0x5F81);
     api->write_raw(0x1F81);
-    delay(BRWAITDIS2);
+    delay(&ctx->sub, BRWAITDIS2);
 
     // disconnect all cells
     api->write_raw(0x4001);
     api->write_raw(0x0001);
-    delay(BRWAITHIZ);
+    delay(&ctx->sub, BRWAITHIZ);
+
+    JD_CORO_END(&ctx->sub);
+}
+
+// BrRfshPtn: Refresh and load new braille pattern
+int BrRfshPtn(br_ctx_t * ctx, const hbridge_api_t * api) {
+    JD_CORO_BEGIN(&ctx->co);
+
+    // force clear
+    JD_CORO_AWAIT(&ctx->co, &ctx->sub, BrForceAllDots(ctx, api, BRPHASEDN));
+
+    // load new pattern
+    for (ctx->row = 0; ctx->row < MAXBRROW; ctx->row++) {
+        for (ctx->col = 0; ctx->col < MAXBRCOL; ctx->col++) {
+            // only set direction
+            if (BrDotPtn[ctx->row][ctx->col] == true) {
+                JD_CORO_AWAIT(&ctx->co, &ctx->sub, BrSetSingleDot(ctx, api, true));
+            }
+        }
+    }
+
+    JD_CORO_END(&ctx->co);
+}
+
+// BrClrAllDots: Clear All Dots (forced)
+int BrClrAllDots(br_ctx_t * ctx, const hbridge_api_t * api) {
+    JD_CORO_BEGIN(&ctx->co);
+    JD_CORO_AWAIT(&ctx->co, &ctx->sub, BrForceAllDots(ctx, api, BRPHASEDN));
+    JD_CORO_END(&ctx->co);
+}
+
+// BrSetAllDots: Set All Dots (forced)
+int BrSetAllDots(br_ctx_t * ctx, const hbridge_api_t * api) {
+    JD_CORO_BEGIN(&ctx->co);
+    JD_CORO_AWAIT(&ctx->co, &ctx->sub, BrForceAllDots(ctx, api, BRPHASEUP));
+    JD_CORO_END(&ctx->co);
 }
@@ -2,12 +2,20 @@
 
 #include "jd_services.h"
 
+// state of the coroutines below, which wait tens of milliseconds for each dot; they return
+// JD_CORO_WAITING until done, and have to be called again after ctx->co.wake
+typedef struct {
+    jd_coro_t co;
+    jd_coro_t sub;
+    uint8_t row;
+    uint8_t col;
+} br_ctx_t;
+
 bool BrGetPtn(uint16_t row, uint16_t col);
 void BrSetPtn(uint16_t row, uint16_t col, bool state);
 void BrClrPtn(void);
-void BrClrAllDots(const hbridge_api_t* api);
-void BrSetSingleDot(const hbridge_api_t* state, uint16_t row, uint16_t col, bool set);
-void BrRfshPtn(const hbridge_api_t* api);
-void BrSetAllDots(const hbridge_api_t * api);
+int BrClrAllDots(br_ctx_t* ctx, const hbridge_api_t* api);
+int BrRfshPtn(br_ctx_t* ctx, const hbridge_api_t* api);
+int BrSetAllDots(br_ctx_t* ctx, const hbridge_api_t * api);
 
 #endif
\ No newline at end of file
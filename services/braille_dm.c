@@ -34,6 +34,7 @@ struct srv_state {
     uint32_t now;
     uint8_t dots[DOTS_MAX];
     const uint8_t* cell_map;
+    br_ctx_t br;
 };
 
 REG_DEFINITION(                                   //
@@ -52,9 +53,13 @@ REG_DEFINITION(                                   //
 
 void braille_dm_process(srv_t * state) {
     if (state->flags & STATE_DIRTY) {
-        BrRfshPtn(state->api);
+        if (BrRfshPtn(&state->br, state->api) == JD_CORO_WAITING) {
+            jd_services_wake_at(state, state->br.co.wake);
+            return;
+        }
         state->flags &= ~STATE_DIRTY;
     }
+    jd_services_wake_on_packet(state);
 }
 
 static bool get_bit(srv_t * state, uint8_t* data, uint16_t row, uint16_t col) {
@@ -145,8 +150,7 @@ void braille_dm_init(const hbridge_api_t *params, uint16_t rows, uint16_t cols,
 
     memset(state->dots, 0, DOTS_MAX);
 
+    // the first process() clears all dots
     BrClrPtn();
-
-    BrClrAllDots(state->api);
-    target_wait_us(3000);
+    state->flags = STATE_DIRTY;
 }
\ No newline at end of file
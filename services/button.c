@@ -57,8 +57,17 @@ void button_handle_packet(srv_t *state, jd_packet_t *pkt) {
 
 SRV_DEF(button, JD_SERVICE_CLASS_BUTTON);
 
+// UP carries the press length, so a pending HOLD says nothing more
+static const jd_event_coalesce_t button_coalesce[] = {
+    {JD_BUTTON_EV_DOWN, 0, 0},
+    {JD_BUTTON_EV_HOLD, 1, 0},
+    {JD_BUTTON_EV_UP, 1, 0},
+};
+
 void button_init(uint8_t pin, bool active, uint8_t backlight_pin) {
     SRV_ALLOC(button);
+    jd_event_set_coalesce(state, button_coalesce,
+                          sizeof(button_coalesce) / sizeof(button_coalesce[0]));
     state->pin = pin;
     state->backlight_pin = backlight_pin;
     state->active = active;
@@ -38,11 +38,14 @@ static int respond_ranges(srv_t *state) {
     while (r->range)
         r++;
     int len = r - state->api->ranges;
-    uint32_t buf[len];
-    r = state->api->ranges;
-    for (int i = 0; i < len; ++i)
-        buf[i] = r[i].range;
-    jd_send(state->service_index, JD_GET(JD_REG_SUPPORTED_RANGES), buf, len * sizeof(uint32_t));
+    uint32_t *dst =
+        jd_send_reserve(state->service_index, JD_GET(JD_REG_SUPPORTED_RANGES), len * 4);
+    if (dst) {
+        r = state->api->ranges;
+        for (int i = 0; i < len; ++i)
+            dst[i] = r[i].range;
+        jd_send_commit();
+    }
     return -JD_REG_SUPPORTED_RANGES;
 }
 
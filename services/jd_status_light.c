@@ -128,11 +128,23 @@ static void rgbled_animate(status_ctx_t *state, const jd_control_set_status_ligh
     }
 }
 
+// the animation only needs ticks while a status is shown, or a channel is off its target
+static void status_wake(status_ctx_t *state) {
+    int busy = state->jd_status != JD_STATUS_OFF;
+    for (int i = 0; i < 3; ++i)
+        if (state->channels[i].value != state->channels[i].target << 8)
+            busy = 1;
+    if (busy)
+        jd_services_wake_at(NULL, state->step_sample);
+}
+
 void jd_status_process() {
     status_ctx_t *state = &status_ctx;
 
-    if (!jd_should_sample(&state->step_sample, FRAME_US))
+    if (!jd_should_sample(&state->step_sample, FRAME_US)) {
+        status_wake(state);
         return;
+    }
 
     if (state->jd_status && in_past(state->jd_status_stop)) {
         jd_control_set_status_light_t off_color = {
@@ -162,6 +174,8 @@ void jd_status_process() {
 
     if (chg)
         rgbled_show(state);
+
+    status_wake(state);
 }
 
 int jd_status_handle_packet(jd_packet_t *pkt) {
@@ -118,6 +118,7 @@ SRV_DEF(joystick, JD_SERVICE_CLASS_JOYSTICK);
 
 void joystick_init(const joystick_params_t *params) {
     SRV_ALLOC(joystick);
+    service_index_registers(state, joystick_regs);
     state->params = *params;
 
     for (unsigned i = 0; i < sizeof(state->params.pinBtns); ++i) {
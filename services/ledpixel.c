@@ -71,17 +71,17 @@ typedef union {
     uint32_t val;
 } RGB;
 
-REG_DEFINITION(                                 //
-    ledpixel_regs,                              //
-    REG_SRV_COMMON,                             //
-    REG_U8(JD_LED_PIXEL_REG_BRIGHTNESS),        //
-    REG_U8(JD_LED_PIXEL_REG_ACTUAL_BRIGHTNESS), //
-    REG_U8(JD_LED_PIXEL_REG_LIGHT_TYPE),        //
-    REG_U8(JD_LED_PIXEL_REG_VARIANT),           //
-    REG_U16(JD_LED_PIXEL_REG_NUM_PIXELS),       //
-    REG_U16(JD_LED_PIXEL_REG_MAX_POWER),        //
-    REG_U16(JD_LED_PIXEL_REG_MAX_PIXELS),       //
-    REG_U16(JD_LED_PIXEL_REG_NUM_REPEATS),      //
+REG_DEFINITION(                                             //
+    ledpixel_regs,                                          //
+    REG_SRV_COMMON,                                         //
+    REG_U8(JD_LED_PIXEL_REG_BRIGHTNESS),                    //
+    REG_NOTIFY(REG_U8(JD_LED_PIXEL_REG_ACTUAL_BRIGHTNESS)), //
+    REG_U8(JD_LED_PIXEL_REG_LIGHT_TYPE),                    //
+    REG_U8(JD_LED_PIXEL_REG_VARIANT),                       //
+    REG_U16(JD_LED_PIXEL_REG_NUM_PIXELS),                   //
+    REG_U16(JD_LED_PIXEL_REG_MAX_POWER),                    //
+    REG_U16(JD_LED_PIXEL_REG_MAX_PIXELS),                   //
+    REG_U16(JD_LED_PIXEL_REG_NUM_REPEATS),                  //
 )
 
 struct srv_state {
@@ -650,4 +650,6 @@ void ledpixel_init(uint8_t default_ledpixel_type, uint32_t default_num_pixels,
     state->variant = variant;
     state->num_repeats = 1;
     state->intensity = state->requested_intensity = DEFAULT_INTENSITY;
+    service_index_registers(state, ledpixel_regs);
+    service_notify_registers(state, ledpixel_regs);
 }
@@ -232,8 +232,18 @@ void multitouch_handle_packet(srv_t *state, jd_packet_t *pkt) {
 
 SRV_DEF(multitouch, JD_SERVICE_CLASS_MULTITOUCH);
 
+// a pin touched and released within a tick only reports the release
+static const jd_event_coalesce_t multitouch_coalesce[] = {
+    {JD_MULTITOUCH_EV_TOUCH, 1, sizeof(int)},
+    {JD_MULTITOUCH_EV_RELEASE, 1, sizeof(int)},
+    {JD_MULTITOUCH_EV_SWIPE_POS, 0, 0},
+    {JD_MULTITOUCH_EV_SWIPE_NEG, 0, 0},
+};
+
 void multitouch_init(const uint8_t *pins) {
     SRV_ALLOC(multitouch);
+    jd_event_set_coalesce(state, multitouch_coalesce,
+                          sizeof(multitouch_coalesce) / sizeof(multitouch_coalesce[0]));
 
     tim_max_sleep = SAMPLING_US;
 
@@ -110,6 +110,7 @@ void speech_synth_handle_packet(srv_t *state, jd_packet_t *pkt) {
 SRV_DEF(speech_synth, JD_SERVICE_CLASS_SPEECH_SYNTHESIS);
 void speech_synthesis_init(const speech_synth_api_t *params) {
     SRV_ALLOC(speech_synth);
+    service_index_registers(state, speech_synth_regs);
     state->api = params;
     state->flags = 0;
     state->pitch = 1 << 16;
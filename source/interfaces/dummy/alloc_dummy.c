@@ -18,6 +18,11 @@ __attribute__((weak)) void *jd_alloc(uint32_t size) {
 __attribute__((weak)) void jd_free(void* ptr) {
 }
 
+__attribute__((weak)) jd_alloc_stats_t *jd_alloc_get_stats(void) {
+    static jd_alloc_stats_t stats;
+    return &stats;
+}
+
 __attribute__((weak)) void *jd_alloc_emergency_area(uint32_t size) {
     return NULL;
 }
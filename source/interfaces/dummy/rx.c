@@ -7,8 +7,16 @@
 __attribute__((weak)) void jd_rx_init(void) {
 }
 
+__attribute__((weak)) jd_frame_t *jd_rx_get_free_frame(void) {
+    static jd_frame_t frame;
+    return &frame;
+}
+
 __attribute__((weak)) int jd_rx_frame_received(jd_frame_t *frame) {
 }
 
 __attribute__((weak)) jd_frame_t* jd_rx_get_frame(void) {
+}
+
+__attribute__((weak)) void jd_rx_release_frame(jd_frame_t *frame) {
 }
\ No newline at end of file
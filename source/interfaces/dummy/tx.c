@@ -13,9 +13,24 @@ __attribute__((weak)) void jd_tx_init(void) {
 __attribute__((weak)) void jd_send(unsigned service_num, unsigned service_cmd, const void *data, unsigned service_size) {
 }
 
+__attribute__((weak)) void *jd_send_reserve(unsigned service_num, unsigned service_cmd,
+                                            unsigned service_size) {
+    return NULL;
+}
+
+__attribute__((weak)) void jd_send_commit(void) {
+}
+
+__attribute__((weak)) void jd_send_abort(void) {
+}
+
 __attribute__((weak)) void jd_send_event_ext(srv_t *srv, uint32_t eventid, uint32_t arg) {
 }
 
+__attribute__((weak)) void jd_event_set_coalesce(srv_t *srv, const jd_event_coalesce_t *rules,
+                                                 unsigned num_rules) {
+}
+
 __attribute__((weak)) jd_frame_t *jd_tx_get_frame(void) {
     return NULL;
 }
@@ -25,3 +40,8 @@ __attribute__((weak)) void jd_tx_frame_sent(jd_frame_t *pkt) {
 
 __attribute__((weak)) void jd_tx_flush(void) {
 }
+
+__attribute__((weak)) jd_tx_class_stats_t *jd_tx_get_stats(void) {
+    static jd_tx_class_stats_t stats[JD_TX_NUM_CLASSES];
+    return stats;
+}
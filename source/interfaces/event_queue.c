@@ -3,28 +3,98 @@
 
 #include "jd_protocol.h"
 
+/*
+ * Events are sent right away, and re-transmitted according to the service's jd_event_policy_t.
+ * Pending events are kept in a ring buffer of JD_EVENT_QUEUE_SIZE bytes, oldest first; events
+ * that are done before the ones ahead of them are marked EV_DEAD, and their space is reclaimed
+ * once they get to the head. A binary min-heap of ring offsets, by re-transmission time, tells
+ * which event is due next, so enqueue, re-transmission and retirement are O(log n).
+ * When the queue is full, the oldest events are dropped.
+ * With JD_CONFIG_EVENT_COALESCE, events the service listed in jd_event_set_coalesce() are first
+ * held back (in the JD_EV_BATCH payload format: size, code, data) until the end of the tick, or until an event of
+ * another service is held back.
+ */
+
+#define EV_WRAP 0xff // in service_index; the next event is at the start of the buffer
+#define EV_DEAD 0xfe // in service_index; done, waiting to get to the head
+// service_index also holds the number of re-transmissions left
+#define EV_INDEX(ev) ((ev)->service_index & JD_SERVICE_INDEX_MASK)
+#define EV_LEFT(ev) ((ev)->service_index >> 6)
+
+STATIC_ASSERT(JD_CONFIG_MAX_SERVICES < (EV_DEAD & JD_SERVICE_INDEX_MASK));
+STATIC_ASSERT(JD_EVENT_RETRANSMITS <= JD_EVENT_MAX_RETRANSMITS);
+
 typedef struct {
-    uint32_t timestamp;
+    uint32_t timestamp; // next re-transmission
     uint8_t service_size;
     uint8_t service_index;
     uint16_t service_command;
     uint8_t data[0];
 } ev_t;
 
+#define MAX_EVENTS (JD_EVENT_QUEUE_SIZE / sizeof(ev_t))
+
+// services with their own policy or coalescing rules
+typedef struct ev_service {
+    struct ev_service *next;
+    const jd_event_policy_t *policy;
+    const jd_event_coalesce_t *rules;
+    uint8_t num_rules;
+    uint8_t service_index;
+} ev_service_t;
+
+static const jd_event_policy_t default_policy = {
+    .retransmits = JD_EVENT_RETRANSMITS,
+    .first_ms = JD_EVENT_RETRANSMIT_FIRST_MS,
+    .interval_ms = JD_EVENT_RETRANSMIT_INTERVAL_MS,
+};
+
+#if JD_CONFIG_EVENT_ACK == 1
+// event packets of recently sent frames with JD_FRAME_FLAG_ACK_REQUESTED
+#define ACK_SLOTS JD_EVENT_ACK_SLOTS
+typedef struct {
+    uint16_t crc;
+    uint16_t service_command;
+    uint8_t service_index;
+} ack_slot_t;
+static ack_slot_t ack_slots[ACK_SLOTS];
+static uint8_t ack_ptr;
+#endif
+
+#if JD_CONFIG_EVENT_COALESCE == 1
+STATIC_ASSERT(JD_EVENT_COALESCE_SIZE <= JD_SERIAL_PAYLOAD_SIZE);
+// events held back, all of 'held_service'
+static uint8_t held[JD_EVENT_COALESCE_SIZE];
+static uint8_t held_size, held_count, held_service;
+#endif
+
 struct event_info {
-    ev_t *buffer;
+    uint8_t *buffer;
+    uint16_t *heap; // ring offsets of events with re-transmissions left
     cb_t process;
-    uint16_t qptr;
+    ev_service_t *services;
+    uint16_t head, tail; // byte offsets in buffer
+    uint16_t num_events; // in the ring, including EV_DEAD ones
+    uint16_t num_heap;
     uint8_t counter;
 };
 static struct event_info info;
+static jd_event_stats_t stats;
+
+static inline ev_t *ev_at(unsigned off) {
+    return (ev_t *)(info.buffer + off);
+}
 
 static inline uint32_t ev_size(ev_t *ev) {
     return sizeof(ev_t) + ((ev->service_size + 3) & ~3);
 }
 
-static inline ev_t *next_ev(ev_t *ev) {
-    return (ev_t *)((uint8_t *)ev + ev_size(ev));
+// offset of the event after the one at 'off'; only valid if there is one
+static unsigned ev_next(unsigned off) {
+    off += ev_size(ev_at(off));
+    if (off + sizeof(ev_t) > JD_EVENT_QUEUE_SIZE || ev_at(off)->service_index == EV_WRAP)
+        return 0;
+    return off;
 }
 
 static uint16_t next_event_cmd(uint32_t eventid) {
@@ -34,50 +104,169 @@ static uint16_t next_event_cmd(uint32_t eventid) {
     return JD_CMD_EVENT_MK(info.counter, eventid);
 }
 
-static void ev_shift(void) {
-    int offset = ev_size(info.buffer) >> 2;
-    uint32_t *dst = &info.buffer->timestamp;
-    uint32_t *src = dst + offset;
-    info.qptr -= offset << 2;
-    int words = info.qptr >> 2;
-    while (words--)
-        *dst++ = *src++;
+static ev_service_t *ev_service(unsigned service_index) {
+    for (ev_service_t *p = info.services; p; p = p->next)
+        if (p->service_index == service_index)
+            return p;
+    return NULL;
 }
 
-static void do_process_event_queue(void) {
-    // if info.process != NULL, then info.buffer has been initialized already
-    ev_t *ev = info.buffer;
-    while ((uint8_t *)ev - (uint8_t *)info.buffer < info.qptr) {
-        if (ev->service_index == 0xff) {
-            if (ev == info.buffer) {
-                ev_shift();
-                continue;
-            }
-        } else if (in_past(ev->timestamp)) {
-            if (jd_send(ev->service_index & 0x7f, ev->service_command, ev->data,
-                        ev->service_size) != 0)
+static ev_service_t *ev_service_add(unsigned service_index) {
+    ev_service_t *p = ev_service(service_index);
+    if (p)
+        return p;
+    p = jd_alloc(sizeof(ev_service_t));
+    p->policy = &default_policy;
+    p->service_index = service_index;
+    p->next = info.services;
+    info.services = p;
+    return p;
+}
+
+static const jd_event_policy_t *ev_policy(unsigned service_index) {
+    ev_service_t *p = ev_service(service_index);
+    return p ? p->policy : &default_policy;
+}
+
+static inline int heap_less(unsigned a, unsigned b) {
+    return (int32_t)(ev_at(info.heap[a])->timestamp - ev_at(info.heap[b])->timestamp) < 0;
+}
+
+static inline void heap_swap(unsigned a, unsigned b) {
+    uint16_t tmp = info.heap[a];
+    info.heap[a] = info.heap[b];
+    info.heap[b] = tmp;
+}
+
+static void heap_up(unsigned i) {
+    while (i > 0 && heap_less(i, (i - 1) / 2)) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(unsigned i) {
+    for (;;) {
+        unsigned m = i, l = 2 * i + 1, r = l + 1;
+        if (l < info.num_heap && heap_less(l, m))
+            m = l;
+        if (r < info.num_heap && heap_less(r, m))
+            m = r;
+        if (m == i)
+            return;
+        heap_swap(i, m);
+        i = m;
+    }
+}
+
+static void heap_remove(unsigned i) {
+    info.num_heap--;
+    if (i == info.num_heap)
+        return;
+    info.heap[i] = info.heap[info.num_heap];
+    heap_up(i);
+    heap_down(i);
+}
+
+// drops EV_DEAD events from the head of the ring
+static void ev_trim_head(void) {
+    while (info.num_events && ev_at(info.head)->service_index == EV_DEAD) {
+        info.num_events--;
+        if (info.num_events)
+            info.head = ev_next(info.head);
+        else
+            info.head = info.tail = 0;
+    }
+}
+
+// the event at heap position 'i' won't be re-transmitted any more
+static void ev_retire(unsigned i) {
+    ev_at(info.heap[i])->service_index = EV_DEAD;
+    heap_remove(i);
+    ev_trim_head();
+}
+
+// drops the oldest event (it has re-transmissions left - EV_DEAD ones don't stay at the head)
+static void ev_drop_head(void) {
+    for (unsigned i = 0; i < info.num_heap; ++i)
+        if (info.heap[i] == info.head) {
+            stats.retransmits_dropped += EV_LEFT(ev_at(info.head));
+            ev_retire(i);
+            return;
+        }
+    jd_panic();
+}
+
+// reserves 'size' bytes at the end of the queue, dropping the oldest events if needed
+static ev_t *ev_alloc(unsigned size) {
+    for (;;) {
+        if (info.tail > info.head || info.num_events == 0) {
+            if (JD_EVENT_QUEUE_SIZE - (unsigned)info.tail >= size)
+                break;
+            if (info.head >= size) {
+                ev_at(info.tail)->service_index = EV_WRAP;
+                info.tail = 0;
                 break;
-            if (ev->service_index & 0x80) {
-                if (ev == info.buffer) {
-                    ev_shift();
-                    continue;
-                } else {
-                    ev->service_index = 0xff; // not sure this can happen
-                }
-            } else {
-                ev->timestamp += 50 * 1000;
-                ev->service_index |= 0x80;
             }
+        } else if ((unsigned)info.head - info.tail >= size) {
+            break;
         }
+        ev_drop_head();
+    }
+
+    ev_t *ev = ev_at(info.tail);
+    info.heap[info.num_heap++] = info.tail;
+    info.num_events++;
+    info.tail += size;
+    if (info.tail + sizeof(ev_t) > JD_EVENT_QUEUE_SIZE)
+        info.tail = 0;
+    return ev;
+}
 
-        ev = next_ev(ev);
+static int ev_send(unsigned service_index, unsigned cmd, const void *data, unsigned size,
+                   const jd_event_policy_t *policy) {
+    if (jd_send(service_index, cmd, data, size) != 0)
+        return -1;
+#if JD_CONFIG_EVENT_ACK == 1
+    if (policy->ack)
+        jd_tx_request_ack();
+#endif
+    return 0;
+}
+
+#if JD_CONFIG_EVENT_COALESCE == 1
+static void ev_flush_held(void);
+#endif
+
+static void do_process_event_queue(void) {
+    // if info.process != NULL, then info.buffer has been initialized already
+#if JD_CONFIG_EVENT_COALESCE == 1
+    ev_flush_held();
+#endif
+    while (info.num_heap && in_past(ev_at(info.heap[0])->timestamp)) {
+        ev_t *ev = ev_at(info.heap[0]);
+        const jd_event_policy_t *policy = ev_policy(EV_INDEX(ev));
+        if (ev_send(EV_INDEX(ev), ev->service_command, ev->data, ev->service_size, policy) != 0)
+            return;
+        stats.retransmits++;
+        if (EV_LEFT(ev) == 1) {
+            ev_retire(0);
+        } else {
+            ev->service_index -= 1 << 6;
+            ev->timestamp += policy->interval_ms * 1000;
+            heap_down(0);
+        }
     }
+
+    if (info.num_heap)
+        jd_services_wake_at(NULL, ev_at(info.heap[0])->timestamp);
 }
 
 static void ev_init(void) {
     if (info.buffer)
         return;
     info.buffer = jd_alloc(JD_EVENT_QUEUE_SIZE);
+    info.heap = jd_alloc(MAX_EVENTS * sizeof(uint16_t));
     // this is only linked in, when the code uses event sending functions
     info.process = do_process_event_queue;
 }
@@ -87,28 +276,162 @@ void jd_process_event_queue(void) {
         info.process();
 }
 
-void jd_send_event_ext(srv_t *srv, uint32_t eventid, const void *data, uint32_t data_bytes) {
+void jd_event_set_policy(srv_t *srv, const jd_event_policy_t *policy) {
     srv_common_t *state = (srv_common_t *)srv;
+    if (policy->retransmits > JD_EVENT_MAX_RETRANSMITS)
+        jd_panic();
+    ev_service_add(state->service_index)->policy = policy;
+}
+
+jd_event_stats_t *jd_event_get_stats(void) {
+    return &stats;
+}
+
+// sends the event, and queues its re-transmissions
+static void ev_queue(unsigned service_index, uint32_t eventid, const void *data,
+                     uint32_t data_bytes) {
+    const jd_event_policy_t *policy = ev_policy(service_index);
 
     uint16_t cmd = next_event_cmd(eventid);
-    jd_send(state->service_index, cmd, data, data_bytes);
+    ev_send(service_index, cmd, data, data_bytes, policy);
+
+    if (policy->retransmits == 0)
+        return;
 
     ev_init();
 
-    int reqlen = data_bytes + sizeof(ev_t);
+    unsigned reqlen = sizeof(ev_t) + ((data_bytes + 3) & ~3);
     if (reqlen > JD_EVENT_QUEUE_SIZE)
         return; // too long to queue; shouldn't happen
-    while (JD_EVENT_QUEUE_SIZE - info.qptr < (int)data_bytes)
-        ev_shift();
 
-    ev_t *ev = (ev_t *)((uint8_t *)info.buffer + info.qptr);
+    ev_t *ev = ev_alloc(reqlen);
     ev->service_size = data_bytes;
     ev->service_command = cmd;
-    ev->service_index = state->service_index;
+    ev->service_index = service_index | (policy->retransmits << 6);
     memcpy(ev->data, data, data_bytes);
     // no randomization; it's somewhat often to generate multiple events in the same tick
     // they will this way get the same re-transmission time, and thus be packed in one frame
-    // on both re-transmissions
-    ev->timestamp = now + 20 * 1000;
-    info.qptr += ev_size(ev);
+    // on all re-transmissions
+    ev->timestamp = now + policy->first_ms * 1000;
+    heap_up(info.num_heap - 1);
+}
+
+#if JD_CONFIG_EVENT_COALESCE == 1
+static const jd_event_coalesce_t *ev_rule(ev_service_t *p, unsigned code) {
+    if (p)
+        for (unsigned i = 0; i < p->num_rules; ++i)
+            if (p->rules[i].code == code)
+                return &p->rules[i];
+    return NULL;
+}
+
+static void ev_flush_held(void) {
+    if (!held_count)
+        return;
+    if (held_count == 1) {
+        ev_queue(held_service, held[1], held + 2, held[0]);
+    } else {
+        ev_queue(held_service, JD_EV_BATCH, held, held_size);
+        stats.batches++;
+    }
+    held_count = 0;
+    held_size = 0;
+}
+
+// returns 0 if the event is to be sent right away
+static int ev_hold(unsigned service_index, unsigned code, const void *data, unsigned size) {
+    ev_service_t *p = ev_service(service_index);
+    const jd_event_coalesce_t *rule = ev_rule(p, code);
+
+    // keep the order of events of a service
+    if (held_count && (held_service == service_index) != (rule != NULL))
+        ev_flush_held();
+    if (!rule)
+        return 0;
+
+    if (rule->group)
+        for (unsigned ptr = 0; ptr < held_size; ptr += held[ptr] + 2) {
+            const jd_event_coalesce_t *r = ev_rule(p, held[ptr + 1]);
+            if (r->group != rule->group || held[ptr] < rule->key_bytes ||
+                size < rule->key_bytes || memcmp(held + ptr + 2, data, rule->key_bytes))
+                continue;
+            // there is at most one, as it would have superseded any earlier one
+            unsigned esize = held[ptr] + 2;
+            memmove(held + ptr, held + ptr + esize, held_size - ptr - esize);
+            held_size -= esize;
+            held_count--;
+            stats.superseded++;
+            break;
+        }
+
+    unsigned esize = size + 2;
+    if (held_size + esize > JD_EVENT_COALESCE_SIZE) {
+        ev_flush_held();
+        if (esize > JD_EVENT_COALESCE_SIZE)
+            return 0;
+    }
+    uint8_t *dst = held + held_size;
+    dst[0] = size;
+    dst[1] = code;
+    memcpy(dst + 2, data, size);
+    held_size += esize;
+    held_count++;
+    held_service = service_index;
+
+    ev_init();
+    // jd_process_event_queue() sends them
+    jd_services_wake_at(NULL, now);
+    return 1;
+}
+#endif
+
+void jd_event_set_coalesce(srv_t *srv, const jd_event_coalesce_t *rules, unsigned num_rules) {
+#if JD_CONFIG_EVENT_COALESCE == 1
+    srv_common_t *state = (srv_common_t *)srv;
+    ev_service_t *p = ev_service_add(state->service_index);
+    p->rules = rules;
+    p->num_rules = num_rules;
+#endif
+}
+
+void jd_send_event_ext(srv_t *srv, uint32_t eventid, const void *data, uint32_t data_bytes) {
+    srv_common_t *state = (srv_common_t *)srv;
+    stats.events++;
+#if JD_CONFIG_EVENT_COALESCE == 1
+    if (ev_hold(state->service_index, eventid, data, data_bytes))
+        return;
+#endif
+    ev_queue(state->service_index, eventid, data, data_bytes);
+}
+
+#if JD_CONFIG_EVENT_ACK == 1
+void jd_event_frame_sealed(jd_frame_t *frame) {
+    for (unsigned ptr = 0; ptr + 4 <= frame->size; ptr += (frame->data[ptr] + 4 + 3) & ~3) {
+        // packet fields at 'ptr' line up with jd_packet_t, same as after jd_shift_frame()
+        jd_packet_t *pkt = (jd_packet_t *)((uint8_t *)frame + ptr);
+        if (!(pkt->service_command & JD_CMD_EVENT_MASK))
+            continue;
+        ack_slot_t *s = &ack_slots[ack_ptr++ % ACK_SLOTS];
+        s->crc = frame->crc;
+        s->service_index = pkt->service_index;
+        s->service_command = pkt->service_command;
+    }
+}
+
+void jd_event_ack_received(uint16_t crc) {
+    for (unsigned k = 0; k < ACK_SLOTS; ++k) {
+        ack_slot_t *s = &ack_slots[k];
+        if (s->crc != crc || !s->service_command)
+            continue;
+        for (unsigned i = 0; i < info.num_heap; ++i) {
+            ev_t *ev = ev_at(info.heap[i]);
+            if (ev->service_command == s->service_command && EV_INDEX(ev) == s->service_index) {
+                stats.retransmits_acked += EV_LEFT(ev);
+                ev_retire(i);
+                break;
+            }
+        }
+        s->service_command = 0;
+    }
 }
+#endif
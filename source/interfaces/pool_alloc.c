@@ -0,0 +1,386 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+/*
+ * Replacement for simple_alloc.c (link one or the other), where jd_free() gives memory back.
+ *
+ * Allocations of up to MAX_CLASS_SIZE bytes get a block of the smallest size class that fits.
+ * Blocks of a class are cut from PAGE_SIZE byte pages, taken from the bottom of the heap;
+ * free blocks are on a (doubly linked) list per class, so jd_alloc() and jd_free() are O(1).
+ * Once all the blocks of a page are free, the page goes back to a list of free pages, to be used
+ * by any class (that's O(blocks per page)). Pages freed right below the bottom carve pointer,
+ * or free pages that end up there, are given back to it.
+ *
+ * Bigger allocations are carved to size from the top of the heap; freed ones are merged with
+ * free neighbours, and kept on a list to be reused (first fit, splitting off what's not needed),
+ * or given back to the top carve pointer, if right above it. This is O(number of free big
+ * blocks), but big buffers (pixels, displays, queues) are not allocated often.
+ *
+ * Every block starts with a 4 byte header, so jd_alloc_get_stats() can tell what was asked for
+ * (8 bytes with JD_CONFIG_ALLOC_TAGS, to remember the service it's charged to).
+ * The heap is between the end of static data and the stack, as in simple_alloc.c; with
+ * JD_POOL_HEAP_SIZE defined, it's a static array of that size instead (like on the host).
+ */
+
+#ifdef JD_POOL_HEAP_SIZE
+static uint32_t heap_area[JD_POOL_HEAP_SIZE / 4];
+#define HEAP_BASE ((uintptr_t)heap_area)
+#define HEAP_END (HEAP_BASE + sizeof(heap_area))
+#else
+#define STACK_SIZE 512
+#define STACK_BASE ((uintptr_t)&_estack)
+#define HEAP_BASE ((uintptr_t)&_end)
+#define HEAP_END (STACK_BASE - STACK_SIZE)
+extern uint32_t _end;
+extern uint32_t _estack;
+#endif
+#define HEAP_SIZE (HEAP_END - HEAP_BASE)
+
+typedef struct {
+    uint16_t words; // size of the block, including the header, in 4 byte words
+    uint8_t cls;    // size class, CLS_BIG or CLS_PAGE, with CLS_FREE while free
+    uint8_t slack;  // bytes at the end of the block that were not asked for
+#if JD_CONFIG_ALLOC_TAGS == 1
+    uint8_t tag; // from jd_alloc_tag_charge()
+    uint8_t reserved[3];
+#endif
+    // only while free (this is where the data starts otherwise); heap offsets in words
+    uint16_t next, prev;
+} block_t;
+
+#if JD_CONFIG_ALLOC_TAGS == 1
+#define HEADER_SIZE 8
+#else
+#define HEADER_SIZE 4
+#endif
+#define CLS_BIG 0x7f
+#define CLS_PAGE 0x7e // a big block that took a free page
+#define CLS_FREE 0x80
+#define NONE 0xffff
+#define PAGE_SIZE 256
+#define PAGE_FREE 0xff // in page_used[]
+
+// block sizes, header included; they divide a page with at most 16 bytes left over
+static const uint8_t class_size[] = {16, 24, 32, 48, 64, 84, 128};
+#define NUM_CLASSES (int)(sizeof(class_size) / sizeof(class_size[0]))
+#define MAX_CLASS_SIZE (128 - HEADER_SIZE)
+
+// size class by block size in words
+static uint8_t class_of[128 / 4 + 1];
+// free blocks of every class; the last list has the big blocks
+static uint16_t free_list[NUM_CLASSES + 1];
+// free pages, linked through their first block_t
+static uint16_t free_pages;
+// blocks in use on every page, or PAGE_FREE
+static uint8_t *page_used;
+// pages are carved up to 'bottom', big blocks down to 'top'
+static uintptr_t bottom, top;
+static jd_alloc_stats_t stats;
+
+STATIC_ASSERT(PAGE_SIZE / 16 < PAGE_FREE);
+STATIC_ASSERT(offsetof(block_t, next) == HEADER_SIZE);
+
+static inline block_t *block_at(uint16_t off) {
+    return (block_t *)(HEAP_BASE + off * 4);
+}
+
+static inline uint16_t block_off(block_t *b) {
+    return ((uintptr_t)b - HEAP_BASE) / 4;
+}
+
+static inline unsigned page_of(block_t *b) {
+    return ((uintptr_t)b - HEAP_BASE) / PAGE_SIZE;
+}
+
+static inline block_t *page_at(unsigned page) {
+    return (block_t *)(HEAP_BASE + page * PAGE_SIZE);
+}
+
+static void list_push(uint16_t *list, block_t *b) {
+    b->next = *list;
+    b->prev = NONE;
+    if (b->next != NONE)
+        block_at(b->next)->prev = block_off(b);
+    *list = block_off(b);
+}
+
+static void list_remove(uint16_t *list, block_t *b) {
+    if (b->prev == NONE)
+        *list = b->next;
+    else
+        block_at(b->prev)->next = b->next;
+    if (b->next != NONE)
+        block_at(b->next)->prev = b->prev;
+}
+
+#ifdef JD_POOL_HEAP_SIZE
+void jd_alloc_stack_check(void) {}
+#else
+static uint16_t maxStack;
+
+void jd_alloc_stack_check(void) {
+    uint32_t *ptr = (uint32_t *)(STACK_BASE - STACK_SIZE);
+    while (ptr < (uint32_t *)STACK_BASE) {
+        if (*ptr != 0x33333333)
+            break;
+        ptr++;
+    }
+    int sz = STACK_BASE - (uintptr_t)ptr;
+    if (sz > maxStack)
+        JD_LOG("stk:%d", maxStack = sz);
+}
+#endif
+
+void jd_alloc_init(void) {
+#ifndef JD_POOL_HEAP_SIZE
+    JD_LOG("free:%d", HEAP_SIZE);
+    int p = 0;
+    int sz = (uintptr_t)&p - HEAP_BASE - 32;
+    // seed PRNG with random RAM contents (later we add ADC readings)
+    jd_seed_random(jd_hash_fnv1a((void *)HEAP_BASE, sz));
+    memset((void *)HEAP_BASE, 0x33, sz);
+    jd_alloc_stack_check();
+#endif
+
+    // offsets in words are 16 bit
+    if (HEAP_SIZE > 0x10000 * 4)
+        jd_panic();
+
+    for (int i = 0; i <= NUM_CLASSES; ++i)
+        free_list[i] = NONE;
+    free_pages = NONE;
+    int c = 0;
+    for (unsigned words = 0; words < sizeof(class_of); ++words) {
+        if (words * 4 > class_size[c])
+            c++;
+        class_of[words] = c;
+    }
+    memset(&stats, 0, sizeof(stats));
+    stats.heap_size = HEAP_SIZE;
+
+    unsigned num_pages = HEAP_SIZE / PAGE_SIZE;
+    top = (HEAP_END - num_pages) & ~3;
+    page_used = (uint8_t *)top;
+    bottom = HEAP_BASE;
+}
+
+// gives free pages right below 'bottom' back to it
+static void trim_pages(void) {
+    while (bottom > HEAP_BASE) {
+        unsigned page = (bottom - HEAP_BASE) / PAGE_SIZE - 1;
+        if (page_used[page] != PAGE_FREE)
+            break;
+        list_remove(&free_pages, page_at(page));
+        stats.in_free_lists -= PAGE_SIZE;
+        bottom -= PAGE_SIZE;
+    }
+}
+
+// cuts a free or new page into blocks of class 'cls'
+static int add_page(unsigned cls) {
+    block_t *pg;
+    if (free_pages != NONE) {
+        pg = block_at(free_pages);
+        list_remove(&free_pages, pg);
+        stats.in_free_lists -= PAGE_SIZE;
+    } else if (bottom + PAGE_SIZE <= top) {
+        pg = (block_t *)bottom;
+        bottom += PAGE_SIZE;
+    } else {
+        return 0;
+    }
+    unsigned size = class_size[cls];
+    page_used[page_of(pg)] = 0;
+    for (unsigned off = 0; off + size <= PAGE_SIZE; off += size) {
+        block_t *b = (block_t *)((uint8_t *)pg + off);
+        b->words = size / 4;
+        b->cls = cls | CLS_FREE;
+        list_push(&free_list[cls], b);
+        stats.in_free_lists += size;
+    }
+    return 1;
+}
+
+// the last block of the page was freed; 'size' is the size of its blocks (0 for CLS_PAGE)
+static void free_page(unsigned page, unsigned size) {
+    block_t *pg = page_at(page);
+    for (unsigned off = 0; size && off + size <= PAGE_SIZE; off += size) {
+        list_remove(&free_list[class_of[size / 4]], (block_t *)((uint8_t *)pg + off));
+        stats.in_free_lists -= size;
+    }
+    page_used[page] = PAGE_FREE;
+    list_push(&free_pages, pg);
+    stats.in_free_lists += PAGE_SIZE;
+    trim_pages();
+}
+
+static block_t *alloc_small(unsigned words) {
+    unsigned c = class_of[words];
+    if (free_list[c] == NONE && !add_page(c)) {
+        // no pages left; take a free block of a bigger class
+        while (++c < NUM_CLASSES && free_list[c] == NONE)
+            ;
+        if (c == NUM_CLASSES)
+            return NULL;
+    }
+    block_t *b = block_at(free_list[c]);
+    list_remove(&free_list[c], b);
+    b->cls = c;
+    page_used[page_of(b)]++;
+    stats.in_free_lists -= b->words * 4;
+    return b;
+}
+
+// merges 'b' with free neighbours (big blocks are contiguous, from 'top' up to the page table),
+// and gives it back to 'top', if it's right above it
+static void free_big(block_t *b) {
+    uint16_t *list = &free_list[NUM_CLASSES];
+    block_t *next = (block_t *)((uint8_t *)b + b->words * 4);
+    if ((uintptr_t)next < (uintptr_t)page_used && next->cls == (CLS_BIG | CLS_FREE)) {
+        list_remove(list, next);
+        b->words += next->words;
+    }
+    for (uint16_t off = *list; off != NONE; off = block_at(off)->next) {
+        block_t *prev = block_at(off);
+        if ((uint8_t *)prev + prev->words * 4 == (uint8_t *)b) {
+            list_remove(list, prev);
+            prev->words += b->words;
+            b = prev;
+            break;
+        }
+    }
+    if ((uintptr_t)b == top) {
+        top += b->words * 4;
+        stats.in_free_lists -= b->words * 4;
+    } else {
+        list_push(list, b);
+    }
+}
+
+static block_t *alloc_big(unsigned words) {
+    if (words > 0xffff)
+        return NULL;
+    for (uint16_t off = free_list[NUM_CLASSES]; off != NONE;) {
+        block_t *b = block_at(off);
+        if (b->words < words) {
+            off = b->next;
+            continue;
+        }
+        stats.in_free_lists -= b->words * 4;
+        // the rest stays free, if it's big enough to ever be reused
+        if ((b->words - words) * 4 > MAX_CLASS_SIZE + HEADER_SIZE) {
+            block_t *rest = (block_t *)((uint8_t *)b + words * 4);
+            rest->words = b->words - words;
+            rest->cls = CLS_BIG | CLS_FREE;
+            rest->next = b->next;
+            rest->prev = b->prev;
+            if (rest->prev == NONE)
+                free_list[NUM_CLASSES] = block_off(rest);
+            else
+                block_at(rest->prev)->next = block_off(rest);
+            if (rest->next != NONE)
+                block_at(rest->next)->prev = block_off(rest);
+            stats.in_free_lists += rest->words * 4;
+            b->words = words;
+        } else {
+            list_remove(&free_list[NUM_CLASSES], b);
+        }
+        b->cls = CLS_BIG;
+        return b;
+    }
+
+    if (top - bottom < words * 4) {
+        // out of space in between; use a free page, if it's big enough
+        if (words * 4 > PAGE_SIZE || free_pages == NONE)
+            return NULL;
+        block_t *b = block_at(free_pages);
+        list_remove(&free_pages, b);
+        stats.in_free_lists -= PAGE_SIZE;
+        page_used[page_of(b)] = 1;
+        b->words = PAGE_SIZE / 4;
+        b->cls = CLS_PAGE;
+        return b;
+    }
+    top -= words * 4;
+    block_t *b = (block_t *)top;
+    b->words = words;
+    b->cls = CLS_BIG;
+    return b;
+}
+
+void *jd_alloc(uint32_t size) {
+    jd_alloc_stack_check();
+
+    uint32_t words = (size + HEADER_SIZE + 3) >> 2;
+    block_t *b = size <= MAX_CLASS_SIZE ? alloc_small(words) : alloc_big(words);
+    if (!b || b->words * 4 - HEADER_SIZE - size > 0xff)
+        jd_panic();
+
+    unsigned bytes = b->words * 4;
+    b->slack = bytes - HEADER_SIZE - size;
+    stats.in_use += size;
+    if (stats.in_use > stats.max_in_use)
+        stats.max_in_use = stats.in_use;
+    stats.in_blocks += bytes;
+    stats.num_alloc++;
+#if JD_CONFIG_ALLOC_TAGS == 1
+    b->tag = jd_alloc_tag_charge(bytes);
+#endif
+
+    void *r = (uint8_t *)b + HEADER_SIZE;
+    memset(r, 0, bytes - HEADER_SIZE);
+    return r;
+}
+
+void jd_free(void *ptr) {
+    if (!ptr)
+        return;
+    block_t *b = (block_t *)((uint8_t *)ptr - HEADER_SIZE);
+    if ((uintptr_t)b < HEAP_BASE || (uintptr_t)b >= HEAP_END ||
+        ((uintptr_t)b >= bottom && (uintptr_t)b < top) || (b->cls & CLS_FREE))
+        jd_panic(); // not from jd_alloc(), or freed twice
+
+    unsigned bytes = b->words * 4;
+    stats.in_use -= bytes - HEADER_SIZE - b->slack;
+    stats.in_blocks -= bytes;
+    stats.num_free++;
+#if JD_CONFIG_ALLOC_TAGS == 1
+    jd_alloc_tag_release(b->tag, bytes);
+#endif
+
+    unsigned cls = b->cls;
+    b->cls |= CLS_FREE;
+    stats.in_free_lists += bytes;
+    if (cls == CLS_BIG) {
+        free_big(b);
+    } else if (cls == CLS_PAGE) {
+        stats.in_free_lists -= bytes;
+        free_page(page_of(b), 0);
+    } else {
+        list_push(&free_list[cls], b);
+        unsigned page = page_of(b);
+        if (--page_used[page] == 0)
+            free_page(page, class_size[cls]);
+    }
+}
+
+uint32_t jd_available_memory(void) {
+    uint32_t left = top - bottom;
+    return left > HEADER_SIZE ? left - HEADER_SIZE : 0;
+}
+
+jd_alloc_stats_t *jd_alloc_get_stats(void) {
+    stats.never_used = top - bottom;
+#ifndef JD_POOL_HEAP_SIZE
+    stats.max_stack = maxStack;
+#endif
+    return &stats;
+}
+
+void *jd_alloc_emergency_area(uint32_t size) {
+    if (size > HEAP_SIZE)
+        jd_panic();
+    return (void *)HEAP_BASE;
+}
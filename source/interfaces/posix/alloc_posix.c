@@ -0,0 +1,62 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+#include <stdlib.h>
+
+// pretend to be a small MCU, so that running out of memory is caught on the host as well
+#ifndef JD_POSIX_HEAP_SIZE
+#define JD_POSIX_HEAP_SIZE (16 * 1024)
+#endif
+
+static uint32_t heap_used;
+static void *emergency_area;
+static jd_alloc_stats_t stats;
+
+void jd_alloc_init(void) {
+    heap_used = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void *jd_alloc(uint32_t size) {
+    size = (size + 3) & ~3;
+    heap_used += size;
+    if (heap_used > JD_POSIX_HEAP_SIZE)
+        jd_panic();
+    void *r = calloc(1, size);
+    if (!r)
+        jd_panic();
+    stats.num_alloc++;
+#if JD_CONFIG_ALLOC_TAGS == 1
+    jd_alloc_tag_charge(size);
+#endif
+    return r;
+}
+
+uint32_t jd_available_memory(void) {
+    return JD_POSIX_HEAP_SIZE - heap_used;
+}
+
+// memory is not accounted back (not even to the service), same as with simple_alloc.c
+void jd_free(void *ptr) {
+    stats.num_free++;
+    free(ptr);
+}
+
+jd_alloc_stats_t *jd_alloc_get_stats(void) {
+    stats.heap_size = JD_POSIX_HEAP_SIZE;
+    stats.in_use = stats.max_in_use = stats.in_blocks = heap_used;
+    stats.never_used = JD_POSIX_HEAP_SIZE - heap_used;
+    return &stats;
+}
+
+void jd_alloc_stack_check(void) {}
+
+void *jd_alloc_emergency_area(uint32_t size) {
+    if (size > JD_POSIX_HEAP_SIZE)
+        jd_panic();
+    if (!emergency_area)
+        emergency_area = calloc(1, JD_POSIX_HEAP_SIZE);
+    return emergency_area;
+}
@@ -0,0 +1,42 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if JD_CONFIG_CRC_HW == 1
+
+// Stand-in for a CRC peripheral. It shifts one bit at a time, which is nothing like jd_crc.c,
+// so comparing the two (see bench_crc.c) validates the dispatch in jd_crc16_update().
+
+static uint16_t result;
+static uint8_t running;
+
+static void crc_hw_fail(const char *msg) {
+    fprintf(stderr, "crc_hw: %s\n", msg);
+    abort();
+}
+
+void crc_hw_start(uint16_t crc, const void *data, uint32_t size) {
+    const uint8_t *ptr = (const uint8_t *)data;
+    if (running)
+        crc_hw_fail("already running");
+    running = 1;
+    while (size--) {
+        crc ^= *ptr++ << 8;
+        for (int i = 0; i < 8; ++i)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    result = crc;
+}
+
+uint16_t crc_hw_complete(void) {
+    if (!running)
+        crc_hw_fail("not running");
+    running = 0;
+    return result;
+}
+
+#endif
@@ -0,0 +1,206 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Hardware abstraction layer for running jacdac-c on a host (Linux, macOS).
+ * Clock, timer and UART are backed by the simulated wire in jd_sim.c.
+ * All the state here is per-node; the simulator can load one copy of the library per node.
+ */
+
+#include "jd_protocol.h"
+#include "services/interfaces/jd_hw_pwr.h"
+#include "jd_sim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+uint32_t now;
+uint16_t tim_max_sleep;
+uint8_t cpu_mhz = 64;
+
+static int node_id = -1;
+static uint64_t device_id;
+static cb_t timer_cb;
+static uint8_t irq_disabled, in_irq, in_loop, tx_active;
+static uint64_t irq_disabled_at;
+static void *rx_buf;
+static uint32_t rx_max;
+
+static void node_dispatch(int ev_type) {
+    if (ev_type == JD_SIM_EV_LOOP) {
+        in_loop = 1;
+        jd_process_everything();
+        in_loop = 0;
+        // like pwr_sleep() would, wait for an interrupt, or the next deadline of the services
+        uint32_t d = jd_services_max_sleep();
+        if (tim_max_sleep && d > tim_max_sleep)
+            d = tim_max_sleep;
+        jd_sim_sleep(node_id, jd_sim_now() + d);
+        return;
+    }
+
+    in_irq = 1;
+    switch (ev_type) {
+    case JD_SIM_EV_TIMER: {
+        cb_t cb = timer_cb;
+        timer_cb = NULL;
+        if (cb)
+            cb();
+        break;
+    }
+    case JD_SIM_EV_LINE_FALLING:
+        // the UART doesn't see its own lo-pulse, nor lo-pulses during reception
+        if (!tx_active && !rx_buf)
+            jd_line_falling();
+        break;
+    case JD_SIM_EV_RX_DONE: {
+        uint32_t len = jd_sim_rx_read(node_id, rx_buf, rx_max);
+        uint32_t max = rx_max;
+        rx_buf = NULL;
+        jd_sim_rx_stop(node_id);
+        jd_rx_completed(max - len);
+        break;
+    }
+    case JD_SIM_EV_RX_DATA:
+        // the "DMA" has copied what arrived so far
+        if (rx_buf)
+            jd_rx_data_received(jd_sim_rx_read(node_id, rx_buf, rx_max));
+        break;
+    case JD_SIM_EV_TX_DONE:
+        tx_active = 0;
+        jd_tx_completed(0);
+        break;
+    }
+    in_irq = 0;
+}
+
+static const jd_sim_node_ops_t node_ops = {
+    .dispatch = node_dispatch,
+};
+
+void jd_posix_start(uint64_t id) {
+    device_id = id;
+    node_id = jd_sim_attach(&node_ops);
+    jd_seed_random(jd_hash_fnv1a(&id, sizeof(id)));
+    now = (uint32_t)jd_sim_now();
+    jd_init();
+}
+
+void jd_posix_log(const char *format, ...) {
+    static int enabled = -1;
+    if (enabled < 0)
+        enabled = getenv("JD_LOG") != NULL;
+    if (!enabled)
+        return;
+    va_list ap;
+    va_start(ap, format);
+    fprintf(stderr, "%d: ", node_id);
+    vfprintf(stderr, format, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+}
+
+void hw_panic(void) {
+    fprintf(stderr, "panic on node %d\n", node_id);
+    abort();
+}
+
+uint64_t hw_device_id(void) {
+    return device_id;
+}
+
+void power_pin_enable(int en) {}
+
+static uint64_t wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned jd_posix_wall_ns(void) {
+    return (unsigned)wall_ns();
+}
+
+void target_enable_irq(void) {
+    if (irq_disabled == 0)
+        jd_panic();
+    // the simulated clock doesn't move here; measure real time instead
+    if (--irq_disabled == 0)
+        jd_diagnostics_irq_section(wall_ns() - irq_disabled_at);
+}
+
+void target_disable_irq(void) {
+    if (irq_disabled++ == 0)
+        irq_disabled_at = wall_ns();
+}
+
+int target_in_irq(void) {
+    return in_irq;
+}
+
+// busy-waiting doesn't advance the simulated clock
+void target_wait_us(uint32_t n) {}
+
+void target_reset(void) {
+    DMESG("reset requested on node %d", node_id);
+}
+
+void tim_init(void) {}
+
+uint64_t tim_get_micros(void) {
+    if (jd_sim_config.clock_read_us && in_loop && !in_irq && !irq_disabled)
+        jd_sim_busy(node_id, jd_sim_config.clock_read_us);
+    return jd_sim_now();
+}
+
+void tim_set_timer(int delta, cb_t cb) {
+    if (delta < 0)
+        delta = 0;
+    timer_cb = cb;
+    jd_sim_set_timer(node_id, jd_sim_now() + delta);
+}
+
+void uart_init(void) {}
+
+int uart_start_tx(const void *data, uint32_t numbytes) {
+    if (rx_buf || jd_sim_tx_start(node_id, data, numbytes) < 0)
+        return -1;
+    tx_active = 1;
+    return 0;
+}
+
+void uart_start_rx(void *data, uint32_t maxbytes) {
+    rx_buf = data;
+    rx_max = maxbytes;
+    jd_sim_rx_start(node_id);
+}
+
+void uart_disable(void) {
+    rx_buf = NULL;
+    jd_sim_rx_stop(node_id);
+}
+
+// the line is back high by the time jd_line_falling() is dispatched
+int uart_wait_high(void) {
+    return 0;
+}
+
+void uart_flush_rx(void) {
+    if (rx_buf)
+        jd_sim_rx_read(node_id, rx_buf, rx_max);
+}
+
+// there is no sleep on the host; the simulator runs the main loop, see node_dispatch()
+void pwr_enter_pll(void) {}
+void pwr_leave_pll(void) {}
+bool pwr_in_pll(void) {
+    return false;
+}
+void pwr_enter_tim(void) {}
+void pwr_leave_tim(void) {}
+void pwr_sleep(void) {}
+void pwr_wait_tim(void) {}
+void pwr_enter_no_sleep(void) {}
+void pwr_leave_no_sleep(void) {}
@@ -0,0 +1,448 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// number of frames kept around for receivers that are still reading them
+#define MAX_TX 16
+
+typedef struct {
+    uint64_t time;
+    uint32_t seq;
+    uint32_t gen;
+    int16_t node;
+    uint8_t type;
+} sim_ev_t;
+
+typedef struct {
+    const jd_sim_node_ops_t *ops;
+    uint32_t timer_gen;
+    uint32_t rx_gen;
+    uint32_t loop_gen;
+    uint8_t busy;  // in jd_sim_busy()
+    uint8_t woken; // got an interrupt while busy
+    int rx_tx; // frame being received, or -1
+    jd_sim_node_stats_t stats;
+} sim_node_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t group; // id of the first frame of a group of colliding frames
+    int node;
+    uint64_t start;
+    uint64_t data_start;
+    uint64_t end;
+    // only valid on the first frame of a group
+    uint64_t group_end;
+    uint32_t group_size;
+    uint32_t len;
+    uint8_t data[JD_SIM_MAX_FRAME];
+} sim_tx_t;
+
+jd_sim_config_t jd_sim_config = {
+    .loop_us = 100,
+    .irq_latency_us = 2,
+    .collision_window_us = 1,
+};
+
+static uint64_t sim_now;
+static uint32_t ev_seq;
+static sim_ev_t *heap;
+static uint32_t heap_size, heap_alloc;
+
+static sim_node_t nodes[JD_SIM_MAX_NODES];
+static int num_nodes;
+
+static sim_tx_t txs[MAX_TX];
+static uint32_t tx_ptr;
+static int curr_tx = -1;
+static uint64_t line_idle_at;
+static jd_sim_wire_stats_t wire_stats;
+
+static jd_sim_monitor_t monitor;
+static jd_sim_probe_t probe;
+static int curr_node = -1;
+
+static void sim_panic(const char *msg) {
+    fprintf(stderr, "jd_sim: %s\n", msg);
+    abort();
+}
+
+static inline int ev_before(const sim_ev_t *a, const sim_ev_t *b) {
+    if (a->time != b->time)
+        return a->time < b->time;
+    return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static void ev_push(int node, int type, uint64_t time, uint32_t gen) {
+    if (heap_size == heap_alloc) {
+        heap_alloc = heap_alloc ? heap_alloc * 2 : 256;
+        heap = realloc(heap, heap_alloc * sizeof(sim_ev_t));
+        if (!heap)
+            sim_panic("out of memory");
+    }
+    sim_ev_t ev = {.time = time, .seq = ev_seq++, .gen = gen, .node = node, .type = type};
+    uint32_t i = heap_size++;
+    while (i) {
+        uint32_t parent = (i - 1) >> 1;
+        if (!ev_before(&ev, &heap[parent]))
+            break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = ev;
+}
+
+static sim_ev_t ev_pop(void) {
+    sim_ev_t top = heap[0];
+    sim_ev_t last = heap[--heap_size];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= heap_size)
+            break;
+        if (c + 1 < heap_size && ev_before(&heap[c + 1], &heap[c]))
+            c++;
+        if (!ev_before(&heap[c], &last))
+            break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return top;
+}
+
+void jd_sim_reset(void) {
+    sim_now = 0;
+    ev_seq = 0;
+    heap_size = 0;
+    memset(nodes, 0, sizeof(nodes));
+    num_nodes = 0;
+    memset(txs, 0, sizeof(txs));
+    tx_ptr = 0;
+    curr_tx = -1;
+    line_idle_at = 0;
+    memset(&wire_stats, 0, sizeof(wire_stats));
+    monitor = NULL;
+    probe = NULL;
+    curr_node = -1;
+}
+
+int jd_sim_attach(const jd_sim_node_ops_t *ops) {
+    if (num_nodes >= JD_SIM_MAX_NODES)
+        sim_panic("too many nodes");
+    int idx = num_nodes++;
+    sim_node_t *n = &nodes[idx];
+    n->ops = ops;
+    n->rx_tx = -1;
+    // spread main loops of different nodes a bit
+    uint32_t loop_us = jd_sim_config.loop_us ? jd_sim_config.loop_us : 100;
+    ev_push(idx, JD_SIM_EV_LOOP, sim_now + 1 + (idx * 7) % loop_us, 0);
+    return idx;
+}
+
+int jd_sim_num_nodes(void) {
+    return num_nodes;
+}
+
+jd_sim_node_stats_t *jd_sim_node_stats(int node) {
+    return &nodes[node].stats;
+}
+
+jd_sim_wire_stats_t *jd_sim_wire_stats(void) {
+    return &wire_stats;
+}
+
+void jd_sim_set_monitor(jd_sim_monitor_t m) {
+    monitor = m;
+}
+
+void jd_sim_set_probe(jd_sim_probe_t p) {
+    probe = p;
+}
+
+void jd_sim_probe(int kind, uint32_t a, uint32_t b) {
+    if (probe)
+        probe(curr_node, kind, a, b);
+}
+
+uint64_t jd_sim_now(void) {
+    return sim_now;
+}
+
+static uint64_t ns_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// real time spent in dispatch() calls nested in the current one (see jd_sim_busy())
+static uint64_t nested_ns;
+
+static void dispatch(int node, int type) {
+    sim_node_t *n = &nodes[node];
+    int prev_node = curr_node;
+    uint64_t prev_nested = nested_ns;
+    curr_node = node;
+    nested_ns = 0;
+    uint64_t t0 = ns_now();
+    n->ops->dispatch(type);
+    uint64_t total = ns_now() - t0;
+    uint64_t dt = total - nested_ns;
+    nested_ns = prev_nested + total;
+    curr_node = prev_node;
+    if (type == JD_SIM_EV_LOOP) {
+        n->stats.cpu_ns_loop += dt;
+        n->stats.num_loop++;
+    } else {
+        n->stats.cpu_ns_irq += dt;
+        n->stats.num_irq++;
+        if (type == JD_SIM_EV_RX_DONE) {
+            n->stats.cpu_ns_rx_done += dt;
+            n->stats.num_rx_done++;
+        }
+        // without a periodic loop, the node sleeps; any interrupt wakes it up
+        if (!jd_sim_config.loop_us) {
+            if (n->busy)
+                n->woken = 1;
+            else
+                ev_push(node, JD_SIM_EV_LOOP, sim_now, ++n->loop_gen);
+        }
+    }
+}
+
+static void tx_done(sim_tx_t *tx) {
+    int collided = txs[tx->group % MAX_TX].group_size > 1;
+    wire_stats.frames++;
+    if (collided)
+        wire_stats.collisions++;
+    if (monitor)
+        monitor(tx->node, tx->data, tx->len, tx->start, tx->end, collided);
+    if (tx->node != JD_SIM_NODE_EXTERNAL) {
+        if (collided)
+            nodes[tx->node].stats.collisions++;
+        // the sender doesn't notice the collision
+        dispatch(tx->node, JD_SIM_EV_TX_DONE);
+    }
+}
+
+// next chunk of data, unless the frame (or the group of collided frames) ends first
+static void schedule_rx_data(int node) {
+    sim_node_t *n = &nodes[node];
+    sim_tx_t *tx = &txs[n->rx_tx];
+    uint32_t chunk_us = jd_sim_config.rx_chunk_bytes * JD_SIM_BYTE_US;
+    if (!chunk_us)
+        return;
+    uint64_t when = sim_now < tx->data_start ? tx->data_start : sim_now;
+    when += chunk_us - (when - tx->data_start) % chunk_us;
+    if (when < tx->group_end)
+        ev_push(node, JD_SIM_EV_RX_DATA, when, n->rx_gen);
+}
+
+void jd_sim_run_until(uint64_t until) {
+    while (heap_size && heap[0].time <= until) {
+        sim_ev_t ev = ev_pop();
+        sim_now = ev.time;
+        if (ev.node == JD_SIM_NODE_EXTERNAL) {
+            if (ev.type == JD_SIM_EV_TX_DONE)
+                tx_done(&txs[ev.gen]);
+            continue;
+        }
+        sim_node_t *n = &nodes[ev.node];
+        switch (ev.type) {
+        case JD_SIM_EV_TIMER:
+            if (ev.gen == n->timer_gen)
+                dispatch(ev.node, ev.type);
+            break;
+        case JD_SIM_EV_RX_DONE:
+            if (ev.gen == n->rx_gen && n->rx_tx >= 0)
+                dispatch(ev.node, ev.type);
+            break;
+        case JD_SIM_EV_RX_DATA:
+            if (ev.gen == n->rx_gen && n->rx_tx >= 0) {
+                schedule_rx_data(ev.node);
+                dispatch(ev.node, ev.type);
+            }
+            break;
+        case JD_SIM_EV_TX_DONE:
+            tx_done(&txs[ev.gen]);
+            break;
+        case JD_SIM_EV_LOOP:
+            if (ev.gen != n->loop_gen)
+                break;
+            if (n->busy) {
+                // the main loop is still running
+                ev_push(ev.node, JD_SIM_EV_LOOP, sim_now + 1, ev.gen);
+                break;
+            }
+            if (jd_sim_config.loop_us)
+                ev_push(ev.node, JD_SIM_EV_LOOP, sim_now + jd_sim_config.loop_us, n->loop_gen);
+            dispatch(ev.node, ev.type);
+            break;
+        default:
+            dispatch(ev.node, ev.type);
+            break;
+        }
+    }
+    if (until > sim_now)
+        sim_now = until;
+}
+
+void jd_sim_busy(int node, uint32_t us) {
+    sim_node_t *n = &nodes[node];
+    n->busy++;
+    jd_sim_run_until(sim_now + us);
+    n->busy--;
+}
+
+void jd_sim_sleep(int node, uint64_t until) {
+    if (jd_sim_config.loop_us)
+        return;
+    sim_node_t *n = &nodes[node];
+    if (n->woken) {
+        n->woken = 0;
+        until = sim_now;
+    }
+    // a deadline already passed would spin without the clock moving
+    ev_push(node, JD_SIM_EV_LOOP, until <= sim_now ? sim_now + 1 : until, ++n->loop_gen);
+}
+
+void jd_sim_set_timer(int node, uint64_t when) {
+    sim_node_t *n = &nodes[node];
+    if (when < sim_now)
+        when = sim_now;
+    ev_push(node, JD_SIM_EV_TIMER, when, ++n->timer_gen);
+}
+
+int jd_sim_tx_start(int node, const void *data, uint32_t len) {
+    if (len > JD_SIM_MAX_FRAME)
+        sim_panic("frame too long");
+
+    sim_tx_t *group = NULL;
+    if (sim_now < line_idle_at) {
+        group = &txs[curr_tx];
+        if (sim_now - group->start >= jd_sim_config.collision_window_us) {
+            if (node != JD_SIM_NODE_EXTERNAL)
+                nodes[node].stats.tx_busy++;
+            return -1;
+        }
+    }
+
+    uint32_t id = tx_ptr++;
+    int idx = id % MAX_TX;
+    sim_tx_t *tx = &txs[idx];
+    if (idx == curr_tx && group)
+        sim_panic("TX ring overrun");
+    for (int i = 0; i < num_nodes; ++i)
+        if (nodes[i].rx_tx == idx)
+            sim_panic("TX ring overrun");
+
+    tx->id = id;
+    tx->node = node;
+    tx->start = sim_now;
+    tx->data_start = sim_now + JD_SIM_LO_PULSE_US + JD_SIM_LO_GAP_US;
+    tx->end = tx->data_start + len * JD_SIM_BYTE_US;
+    tx->len = len;
+    memcpy(tx->data, data, len);
+
+    if (node != JD_SIM_NODE_EXTERNAL) {
+        nodes[node].stats.frames_sent++;
+        nodes[node].stats.bytes_sent += len;
+    }
+
+    if (group) {
+        tx->group = group->id;
+        group->group_size++;
+        if (tx->end > group->group_end) {
+            wire_stats.busy_us += tx->end - group->group_end;
+            group->group_end = tx->end;
+            line_idle_at = tx->end + JD_SIM_IDLE_US;
+            // whoever is receiving, now receives for longer
+            for (int i = 0; i < num_nodes; ++i)
+                if (nodes[i].rx_tx == curr_tx) {
+                    ev_push(i, JD_SIM_EV_RX_DONE, line_idle_at, ++nodes[i].rx_gen);
+                    schedule_rx_data(i);
+                }
+        }
+    } else {
+        tx->group = id;
+        tx->group_size = 1;
+        tx->group_end = tx->end;
+        curr_tx = idx;
+        line_idle_at = tx->end + JD_SIM_IDLE_US;
+        wire_stats.busy_us += tx->end - tx->start;
+    }
+
+    for (int i = 0; i < num_nodes; ++i)
+        if (i != node)
+            ev_push(i, JD_SIM_EV_LINE_FALLING, sim_now + jd_sim_config.irq_latency_us, 0);
+    ev_push(node, JD_SIM_EV_TX_DONE, tx->end, idx);
+
+    return 0;
+}
+
+int jd_sim_inject(const void *data, uint32_t len) {
+    return jd_sim_tx_start(JD_SIM_NODE_EXTERNAL, data, len);
+}
+
+void jd_sim_rx_start(int node) {
+    sim_node_t *n = &nodes[node];
+    if (curr_tx < 0)
+        sim_panic("RX without TX");
+    n->rx_tx = curr_tx;
+    ev_push(node, JD_SIM_EV_RX_DONE, line_idle_at, ++n->rx_gen);
+    schedule_rx_data(node);
+}
+
+// what a receiver sees on the line at 'time', when 'tx' is being sent
+static uint8_t line_byte(sim_tx_t *tx, uint64_t time) {
+    if (time < tx->start || time >= tx->end)
+        return 0xff;
+    if (time < tx->start + JD_SIM_LO_PULSE_US)
+        return 0x00;
+    if (time < tx->data_start)
+        return 0xff;
+    return tx->data[(time - tx->data_start) / JD_SIM_BYTE_US];
+}
+
+uint32_t jd_sim_rx_read(int node, void *dst, uint32_t maxbytes) {
+    sim_node_t *n = &nodes[node];
+    if (n->rx_tx < 0)
+        return 0;
+    sim_tx_t *tx = &txs[n->rx_tx];
+    uint64_t end = sim_now < tx->group_end ? sim_now : tx->group_end;
+    if (end < tx->data_start)
+        return 0;
+    uint64_t arrived = (end - tx->data_start) / JD_SIM_BYTE_US;
+    uint32_t len = arrived < maxbytes ? (uint32_t)arrived : maxbytes;
+
+    if (tx->group_size == 1) {
+        memcpy(dst, tx->data, len);
+        return len;
+    }
+
+    // the line is open-drain, so it's low when any of the transmitters pulls it low
+    uint8_t *d = dst;
+    for (uint32_t i = 0; i < len; ++i) {
+        uint64_t t = tx->data_start + i * JD_SIM_BYTE_US;
+        uint8_t b = 0xff;
+        for (uint32_t id = tx->id; id != tx_ptr; ++id) {
+            sim_tx_t *other = &txs[id % MAX_TX];
+            if (other->group == tx->id)
+                b &= line_byte(other, t);
+        }
+        d[i] = b;
+    }
+    return len;
+}
+
+void jd_sim_rx_stop(int node) {
+    sim_node_t *n = &nodes[node];
+    n->rx_tx = -1;
+    n->rx_gen++;
+}
@@ -0,0 +1,185 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+/*
+ * Discrete-event simulation of a Jacdac wire, used by the host HAL in hw_posix.c.
+ *
+ * Time is virtual and counted in microseconds. Every node attached to the wire gets its events
+ * (timer expiry, line falling, RX/TX completion, main loop) through a single dispatch callback.
+ * Frames are byte-timed at 1Mbaud - a receiver only sees the bytes that have "arrived" by
+ * the current virtual time.
+ *
+ * Two nodes starting a transmission within jd_sim_config.collision_window_us of each other don't
+ * see each other's lo-pulse and collide - receivers get the wired-AND of both frames.
+ * A node starting later, while the line is still busy, gets an error from uart_start_tx().
+ *
+ * This file has no dependency on the rest of jacdac-c, so that the simulator can live in the
+ * executable, while each node lives in its own copy of the library.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JD_SIM_MAX_NODES 64
+#define JD_SIM_MAX_FRAME 512
+
+// 8N1 at 1Mbaud
+#define JD_SIM_BYTE_US 10
+// length of the lo-pulse, and the gap between its end and the start bit of the first byte
+#define JD_SIM_LO_PULSE_US 11
+#define JD_SIM_LO_GAP_US 40
+// time after the last byte, before UART reports the line as idle
+#define JD_SIM_IDLE_US 2
+
+#define JD_SIM_EV_TIMER 1
+#define JD_SIM_EV_LINE_FALLING 2
+#define JD_SIM_EV_RX_DONE 3
+#define JD_SIM_EV_TX_DONE 4
+#define JD_SIM_EV_LOOP 5
+#define JD_SIM_EV_RX_DATA 6
+
+// the 'node' passed for frames injected with jd_sim_inject()
+#define JD_SIM_NODE_EXTERNAL -1
+
+typedef struct {
+    // invoked when an event for the node is due; stale timer and RX events are filtered out
+    void (*dispatch)(int ev_type);
+} jd_sim_node_ops_t;
+
+typedef struct {
+    // how often the main loop (JD_SIM_EV_LOOP) of every node runs; with 0, nodes sleep between
+    // loops, see jd_sim_sleep()
+    uint32_t loop_us;
+    // delay between the start of the lo-pulse and jd_line_falling() on other nodes
+    uint32_t irq_latency_us;
+    // transmissions starting less than this apart collide, instead of the later one failing
+    uint32_t collision_window_us;
+    // if non-zero, JD_SIM_EV_RX_DATA is dispatched every that many bytes received,
+    // like a DMA half-transfer interrupt would be
+    uint32_t rx_chunk_bytes;
+    // if non-zero, reading the clock in the main loop takes that long (see jd_sim_busy()), so
+    // that busy-waiting code, like jd_services_sleep_us(), sees the time move
+    uint32_t clock_read_us;
+} jd_sim_config_t;
+
+typedef struct {
+    uint64_t cpu_ns_irq;  // real time spent in event handlers other than the main loop
+    uint64_t cpu_ns_loop; // real time spent in the main loop
+    uint32_t num_irq;
+    uint32_t num_loop;
+    uint64_t cpu_ns_rx_done; // part of cpu_ns_irq spent handling JD_SIM_EV_RX_DONE
+    uint32_t num_rx_done;
+    uint32_t frames_sent;
+    uint32_t bytes_sent;
+    uint32_t tx_busy;    // jd_sim_tx_start() refused because the line was low
+    uint32_t collisions; // frames sent that overlapped with another frame
+} jd_sim_node_stats_t;
+
+typedef struct {
+    uint32_t frames;
+    uint32_t collisions; // frames that overlapped with another frame
+    uint64_t busy_us;    // total time the line was not idle
+} jd_sim_wire_stats_t;
+
+/**
+ * Called from jd_sim_probe() - lets code running on nodes report measurements to the benchmark.
+ */
+typedef void (*jd_sim_probe_t)(int node, int kind, uint32_t a, uint32_t b);
+
+/**
+ * Called for every frame that has left the wire (after its last byte).
+ * 'node' is the sender, or JD_SIM_NODE_EXTERNAL; 'collided' is set if no-one could receive it.
+ */
+typedef void (*jd_sim_monitor_t)(int node, const uint8_t *data, uint32_t len, uint64_t start,
+                                 uint64_t end, int collided);
+
+extern jd_sim_config_t jd_sim_config;
+
+/**
+ * Resets the wire, the clock, and detaches all nodes.
+ */
+void jd_sim_reset(void);
+
+/**
+ * Attaches a node to the wire, returns its index. Its main loop is first run on the next tick.
+ */
+int jd_sim_attach(const jd_sim_node_ops_t *ops);
+int jd_sim_num_nodes(void);
+jd_sim_node_stats_t *jd_sim_node_stats(int node);
+jd_sim_wire_stats_t *jd_sim_wire_stats(void);
+
+void jd_sim_set_monitor(jd_sim_monitor_t monitor);
+void jd_sim_set_probe(jd_sim_probe_t probe);
+
+/**
+ * Reports a measurement on behalf of the node whose event is being dispatched.
+ */
+void jd_sim_probe(int kind, uint32_t a, uint32_t b);
+
+uint64_t jd_sim_now(void);
+
+/**
+ * Runs all events up to (and including) 'until'; the clock is left at 'until'.
+ */
+void jd_sim_run_until(uint64_t until);
+
+/**
+ * Called from the main loop of a node: lets 'us' of simulated time pass, dispatching events
+ * (for this and other nodes) as they come, except for the node's own JD_SIM_EV_LOOP.
+ */
+void jd_sim_busy(int node, uint32_t us);
+
+/**
+ * Called by a node at the end of its main loop. With jd_sim_config.loop_us == 0, the main loop
+ * runs again at 'until', or right after the next other event dispatched to the node, if sooner.
+ */
+void jd_sim_sleep(int node, uint64_t until);
+
+/**
+ * Schedules JD_SIM_EV_TIMER for the node; replaces any previously set timer.
+ */
+void jd_sim_set_timer(int node, uint64_t when);
+
+/**
+ * Starts transmission of a frame (lo-pulse, gap, data); JD_SIM_EV_TX_DONE is dispatched after
+ * the last byte. The data is copied.
+ * Returns -1 if the line is already low (unless within the collision window).
+ */
+int jd_sim_tx_start(int node, const void *data, uint32_t len);
+
+/**
+ * Puts a frame on the wire on behalf of a device that is not simulated.
+ */
+int jd_sim_inject(const void *data, uint32_t len);
+
+/**
+ * Called by a node after JD_SIM_EV_LINE_FALLING to receive the current frame.
+ * JD_SIM_EV_RX_DONE is dispatched once the line goes idle, and JD_SIM_EV_RX_DATA
+ * as the data arrives (if enabled with jd_sim_config.rx_chunk_bytes).
+ */
+void jd_sim_rx_start(int node);
+
+/**
+ * Copies bytes received so far (at most 'maxbytes') into 'dst'; returns their number.
+ */
+uint32_t jd_sim_rx_read(int node, void *dst, uint32_t maxbytes);
+
+/**
+ * Aborts reception; a pending JD_SIM_EV_RX_DONE will not be dispatched.
+ */
+void jd_sim_rx_stop(int node);
+
+/**
+ * Implemented by hw_posix.c (i.e., by every node): attaches the node to the wire,
+ * and runs jd_init().
+ */
+void jd_posix_start(uint64_t device_id);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,23 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+// Configuration used when building jacdac-c for the host (see source/interfaces/posix/).
+// Boards supply their own jd_user_config.h; this one is only on the include path of host builds.
+
+#pragma once
+
+// only printed when JD_LOG is set in the environment; see hw_posix.c
+void jd_posix_log(const char *format, ...);
+#define JD_LOG jd_posix_log
+#define DMESG JD_LOG
+
+// no status LED on the host; the application provides jd_status()
+#define JD_CONFIG_STATUS 0
+// target_reset() is a no-op on the host, so the watchdog would only spin
+#define JD_CONFIG_WATCHDOG 0
+// the simulated clock is cheap to read
+#define JD_CONFIG_BUS_STATS 1
+// the simulated clock doesn't move while jacdac-c code runs; profile in real (host) nanoseconds
+#define JD_CONFIG_SERVICE_PROFILE 1
+unsigned jd_posix_wall_ns(void);
+#define JD_PROFILE_CLOCK() jd_posix_wall_ns()
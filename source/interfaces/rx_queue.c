@@ -0,0 +1,87 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+
+#include "jd_protocol.h"
+
+/*
+ * Single-producer (UART IRQ), single-consumer (main loop) ring of received frames.
+ * Frames are received directly into the ring - rxFrames[rxHead] is where the next one goes,
+ * and it's never visible to the main loop. rxHead is only written by the IRQ, rxTail only
+ * by the main loop, so the consumer side never disables IRQs.
+ * With JD_RX_QUEUE_SIZE frames, up to JD_RX_QUEUE_SIZE - 1 can wait for processing.
+ */
+
+STATIC_ASSERT(JD_RX_QUEUE_SIZE >= 2 && JD_RX_QUEUE_SIZE <= 255);
+
+static jd_frame_t *rxFrames;
+static volatile uint8_t rxHead, rxTail;
+#if JD_CONFIG_BUS_STATS == 1
+// when the frame was received; reset to 0 once dispatched
+static uint32_t rxTimes[JD_RX_QUEUE_SIZE];
+#endif
+
+static inline uint8_t next_idx(uint8_t idx) {
+    return idx + 1 == JD_RX_QUEUE_SIZE ? 0 : idx + 1;
+}
+
+void jd_rx_init(void) {
+    if (!rxFrames)
+        rxFrames = (jd_frame_t *)jd_alloc(sizeof(jd_frame_t) * JD_RX_QUEUE_SIZE);
+}
+
+jd_frame_t *jd_rx_get_free_frame(void) {
+    return &rxFrames[rxHead];
+}
+
+int jd_rx_frame_received(jd_frame_t *frame) {
+#ifdef JD_SERVICES_PROCESS_FRAME_PRE
+    JD_SERVICES_PROCESS_FRAME_PRE(frame);
+#endif
+    if (!frame)
+        return 0;
+
+    jd_diagnostics_t *diag = jd_get_diagnostics();
+    uint8_t head = next_idx(rxHead);
+    uint8_t tail = rxTail;
+    if (head == tail) {
+        // the main loop is behind; the frame stays where it is and gets overwritten
+        // (counted as rx_queue_overflow by the caller)
+        return -1;
+    }
+
+#if JD_CONFIG_BUS_STATS == 1
+    rxTimes[rxHead] = (uint32_t)tim_get_micros() | 1;
+#endif
+
+    // frame data has to be in memory before the main loop can see the new head
+    __sync_synchronize();
+    rxHead = head;
+
+    uint32_t depth = head >= tail ? head - tail : head + JD_RX_QUEUE_SIZE - tail;
+    if (depth > diag->rx_queue_high_water)
+        diag->rx_queue_high_water = depth;
+
+    return 0;
+}
+
+jd_frame_t *jd_rx_get_frame(void) {
+    uint8_t tail = rxTail;
+    if (tail == rxHead)
+        return NULL;
+    __sync_synchronize();
+#if JD_CONFIG_BUS_STATS == 1
+    if (rxTimes[tail]) {
+        jd_diagnostics_hist_add(jd_get_diagnostics()->rx_dispatch_hist,
+                                (uint32_t)tim_get_micros() - rxTimes[tail]);
+        rxTimes[tail] = 0;
+    }
+#endif
+    return &rxFrames[tail];
+}
+
+void jd_rx_release_frame(jd_frame_t *frame) {
+    if (frame != &rxFrames[rxTail])
+        jd_panic();
+    __sync_synchronize();
+    rxTail = next_idx(rxTail);
+}
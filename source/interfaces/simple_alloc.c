@@ -14,6 +14,7 @@ extern uint32_t _estack;
 
 static uint32_t *aptr;
 static uint16_t maxStack;
+static jd_alloc_stats_t stats;
 
 void jd_alloc_stack_check(void) {
     uint32_t *ptr = (uint32_t *)(STACK_BASE - STACK_SIZE);
@@ -48,6 +49,10 @@ void *jd_alloc(uint32_t size) {
     if ((uint32_t)aptr > HEAP_END)
         jd_panic();
     memset(r, 0, size << 2);
+    stats.num_alloc++;
+#if JD_CONFIG_ALLOC_TAGS == 1
+    jd_alloc_tag_charge(size << 2);
+#endif
     return r;
 }
 
@@ -55,6 +60,15 @@ uint32_t jd_available_memory() {
     return HEAP_END - (uint32_t)aptr;
 }
 
+// nothing is ever freed, so all of it is in use
+jd_alloc_stats_t *jd_alloc_get_stats(void) {
+    stats.heap_size = HEAP_SIZE;
+    stats.in_use = stats.max_in_use = stats.in_blocks = (uint32_t)aptr - HEAP_BASE;
+    stats.never_used = HEAP_END - (uint32_t)aptr;
+    stats.max_stack = maxStack;
+    return &stats;
+}
+
 void *jd_alloc_emergency_area(uint32_t size) {
     if (size > HEAP_SIZE)
         jd_panic();
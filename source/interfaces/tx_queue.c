@@ -3,8 +3,40 @@
 
 #include "jd_protocol.h"
 
+/*
+ * JD_TX_QUEUE_SIZE frames, shared between priority classes (see JD_TX_CLASS_*).
+ * Every class fills its own frame; the frame is queued once full, or on jd_tx_flush() - unless
+ * the class already has a frame waiting, in which case it keeps filling (this packs packets
+ * into fewer frames when the bus is busy, same as the old two-frame queue did).
+ * The physical layer always gets the oldest queued frame of the most urgent class.
+ * When no frame is free, a class can take over a frame of a less urgent class, dropping
+ * its packets.
+ *
+ * Frames move FREE -> FILLING -> QUEUED in the main loop, and QUEUED -> SENDING -> FREE in IRQ.
+ */
+
+STATIC_ASSERT(JD_TX_QUEUE_SIZE >= 2 && JD_TX_QUEUE_SIZE <= 32);
+
+#define TXQ_FREE 0
+#define TXQ_FILLING 1
+#define TXQ_QUEUED 2
+#define TXQ_SENDING 3
+
 static jd_frame_t *sendFrame;
-static uint8_t bufferPtr, isSending;
+static volatile uint8_t frameState[JD_TX_QUEUE_SIZE];
+static uint8_t frameClass[JD_TX_QUEUE_SIZE];
+static uint16_t frameOrder[JD_TX_QUEUE_SIZE];
+static uint16_t orderCounter;
+#if JD_CONFIG_BUS_STATS == 1
+static uint32_t frameQueuedTime[JD_TX_QUEUE_SIZE];
+#endif
+static int8_t filling[JD_TX_NUM_CLASSES];
+static jd_tx_class_stats_t classStats[JD_TX_NUM_CLASSES];
+// packet between jd_send_reserve() and jd_send_commit()/jd_send_abort()
+static int8_t reservedFrame = -1;
+static uint8_t reservedClass, reservedPrevSize;
+// frame of the last committed packet, for jd_tx_request_ack()
+static int8_t committedFrame = -1;
 
 #if JD_RAW_FRAME
 uint8_t rawFrameSending;
@@ -12,26 +44,182 @@ jd_frame_t *rawFrame;
 #endif
 
 int jd_tx_is_idle() {
-    return !isSending && sendFrame[bufferPtr].size == 0;
+    for (int i = 0; i < JD_TX_QUEUE_SIZE; ++i)
+        if (frameState[i] != TXQ_FREE)
+            return 0;
+    return 1;
 }
 
 void jd_tx_init(void) {
     if (!sendFrame)
-        sendFrame = (jd_frame_t *)jd_alloc(sizeof(jd_frame_t) * 2);
+        sendFrame = (jd_frame_t *)jd_alloc(sizeof(jd_frame_t) * JD_TX_QUEUE_SIZE);
+    for (int i = 0; i < JD_TX_NUM_CLASSES; ++i)
+        filling[i] = -1;
 }
 
-int jd_send(unsigned service_num, unsigned service_cmd, const void *data, unsigned service_size) {
-    if (target_in_irq())
+static unsigned tx_class(unsigned service_num, unsigned service_cmd) {
+    if (service_num == JD_SERVICE_INDEX_CRC_ACK || (service_cmd & JD_CMD_EVENT_MASK) ||
+        (service_num == JD_SERVICE_INDEX_CONTROL && service_cmd == JD_CONTROL_CMD_SERVICES))
+        return JD_TX_CLASS_URGENT;
+    if (service_cmd == JD_GET(JD_REG_READING))
+        return JD_TX_CLASS_STREAMING;
+    return JD_TX_CLASS_RESPONSE;
+}
+
+static uint32_t num_packets(jd_frame_t *frame) {
+    uint32_t n = 0;
+    for (unsigned ptr = 0; ptr < frame->size; ptr += (frame->data[ptr] + 4 + 3) & ~3)
+        n++;
+    return n;
+}
+
+static int class_waiting(unsigned cls) {
+    for (int i = 0; i < JD_TX_QUEUE_SIZE; ++i)
+        if (frameClass[i] == cls && frameState[i] == TXQ_QUEUED)
+            return 1;
+    return 0;
+}
+
+static void seal_frame(int idx) {
+    jd_frame_t *frame = &sendFrame[idx];
+    frame->device_identifier = jd_device_id();
+    jd_compute_crc(frame);
+#if JD_CONFIG_EVENT_ACK == 1
+    if (frame->flags & JD_FRAME_FLAG_ACK_REQUESTED)
+        jd_event_frame_sealed(frame);
+#endif
+    frameOrder[idx] = orderCounter++;
+#if JD_CONFIG_BUS_STATS == 1
+    frameQueuedTime[idx] = (uint32_t)tim_get_micros();
+#endif
+    __sync_synchronize();
+    frameState[idx] = TXQ_QUEUED;
+    jd_services_packet_queued();
+}
+
+// takes over the oldest frame of the least urgent class below 'cls'; returns -1 if none
+static int steal_frame(unsigned cls) {
+    for (unsigned victim = JD_TX_NUM_CLASSES - 1; victim > cls; victim--) {
+        int best = -1;
+        target_disable_irq();
+        for (int i = 0; i < JD_TX_QUEUE_SIZE; ++i) {
+            if (frameClass[i] != victim ||
+                (frameState[i] != TXQ_QUEUED && frameState[i] != TXQ_FILLING))
+                continue;
+            if (best < 0 || (int16_t)(frameOrder[i] - frameOrder[best]) < 0)
+                best = i;
+        }
+        if (best >= 0)
+            frameState[best] = TXQ_FILLING; // so that the physical layer doesn't pick it up
+        target_enable_irq();
+        if (best >= 0) {
+            if (filling[victim] == best)
+                filling[victim] = -1;
+            classStats[victim].packets_dropped += num_packets(&sendFrame[best]);
+            return best;
+        }
+    }
+    return -1;
+}
+
+static int new_frame(unsigned cls) {
+    int idx = -1;
+    for (int i = 0; i < JD_TX_QUEUE_SIZE; ++i)
+        if (frameState[i] == TXQ_FREE) {
+            idx = i;
+            break;
+        }
+    if (idx < 0)
+        idx = steal_frame(cls);
+    if (idx < 0)
+        return -1;
+    frameState[idx] = TXQ_FILLING;
+    frameClass[idx] = cls;
+    frameOrder[idx] = orderCounter;
+    jd_reset_frame(&sendFrame[idx]);
+    filling[cls] = idx;
+    return idx;
+}
+
+void *jd_send_reserve(unsigned service_num, unsigned service_cmd, unsigned service_size) {
+    if (target_in_irq() || reservedFrame >= 0)
         jd_panic();
 
-    void *trg = jd_push_in_frame(&sendFrame[bufferPtr], service_num, service_cmd, service_size);
+    unsigned cls = tx_class(service_num, service_cmd);
+    void *trg = NULL;
+    int idx = filling[cls];
+
+    if (idx >= 0) {
+        reservedPrevSize = sendFrame[idx].size;
+        trg = jd_push_in_frame(&sendFrame[idx], service_num, service_cmd, service_size);
+        if (!trg) {
+            // full - queue it, and start a new one
+            seal_frame(idx);
+            filling[cls] = -1;
+            jd_packet_ready();
+        }
+    }
+
+    if (!trg) {
+        idx = new_frame(cls);
+        if (idx >= 0) {
+            reservedPrevSize = 0;
+            trg = jd_push_in_frame(&sendFrame[idx], service_num, service_cmd, service_size);
+            if (!trg) {
+                // doesn't fit even an empty frame; don't leave it behind (see jd_send_abort())
+                frameState[idx] = TXQ_FREE;
+                filling[cls] = -1;
+            }
+        }
+    }
+
     if (!trg) {
         ERROR("send ovf");
-        return -1;
+        classStats[cls].packets_dropped++;
+        return NULL;
     }
-    if (data)
-        memcpy(trg, data, service_size);
 
+    reservedFrame = idx;
+    reservedClass = cls;
+    return trg;
+}
+
+void jd_send_commit(void) {
+    if (reservedFrame < 0)
+        jd_panic();
+    classStats[reservedClass].packets_queued++;
+    committedFrame = reservedFrame;
+    reservedFrame = -1;
+}
+
+void jd_tx_request_ack(void) {
+    if (committedFrame >= 0 && frameState[committedFrame] == TXQ_FILLING)
+        sendFrame[committedFrame].flags |= JD_FRAME_FLAG_ACK_REQUESTED;
+}
+
+void jd_send_abort(void) {
+    if (reservedFrame < 0)
+        jd_panic();
+    sendFrame[reservedFrame].size = reservedPrevSize;
+    if (reservedPrevSize == 0) {
+        // the frame was started for this packet; an empty frame would keep jd_tx_is_idle() at 0
+        frameState[reservedFrame] = TXQ_FREE;
+        filling[reservedClass] = -1;
+        if (committedFrame == reservedFrame)
+            committedFrame = -1;
+    }
+    reservedFrame = -1;
+}
+
+int jd_send(unsigned service_num, unsigned service_cmd, const void *data, unsigned service_size) {
+    void *trg = jd_send_reserve(service_num, service_cmd, service_size);
+    if (!trg)
+        return -1;
+    if (data) {
+        memcpy(trg, data, service_size);
+        classStats[reservedClass].bytes_copied += service_size;
+    }
+    jd_send_commit();
     return 0;
 }
 
@@ -45,8 +233,19 @@ jd_frame_t *jd_tx_get_frame(void) {
         return r;
     }
 #endif
-    isSending = true;
-    return &sendFrame[bufferPtr ^ 1];
+    int best = -1;
+    for (int i = 0; i < JD_TX_QUEUE_SIZE; ++i) {
+        if (frameState[i] != TXQ_QUEUED)
+            continue;
+        if (best < 0 || frameClass[i] < frameClass[best] ||
+            (frameClass[i] == frameClass[best] &&
+             (int16_t)(frameOrder[i] - frameOrder[best]) < 0))
+            best = i;
+    }
+    if (best < 0)
+        return NULL;
+    frameState[best] = TXQ_SENDING;
+    return &sendFrame[best];
 }
 
 // bridge between phys and queue imp, marks as sent.
@@ -57,21 +256,47 @@ void jd_tx_frame_sent(jd_frame_t *pkt) {
         return;
     }
 #endif
-    isSending = false;
+#if JD_CONFIG_BUS_STATS == 1
+    jd_diagnostics_hist_add(jd_get_diagnostics()->tx_wait_hist,
+                            (uint32_t)tim_get_micros() - frameQueuedTime[pkt - sendFrame]);
+#endif
+    frameState[pkt - sendFrame] = TXQ_FREE;
+    // more to send?
+    for (int i = 0; i < JD_TX_QUEUE_SIZE; ++i)
+        if (frameState[i] == TXQ_QUEUED) {
+            jd_packet_ready();
+            break;
+        }
 }
 
 void jd_tx_flush() {
-    if (target_in_irq())
+    if (target_in_irq() || reservedFrame >= 0)
         jd_panic();
-    if (isSending)
-        return;
-    if (sendFrame[bufferPtr].size == 0)
-        return;
-    sendFrame[bufferPtr].device_identifier = jd_device_id();
-    jd_compute_crc(&sendFrame[bufferPtr]);
-    bufferPtr ^= 1;
-    jd_packet_ready();
-    jd_services_packet_queued();
 
-    jd_reset_frame(&sendFrame[bufferPtr]);
+    int queued = 0;
+    for (int cls = 0; cls < JD_TX_NUM_CLASSES; ++cls) {
+        int idx = filling[cls];
+        if (idx < 0 || sendFrame[idx].size == 0 || class_waiting(cls))
+            continue;
+        seal_frame(idx);
+        filling[cls] = -1;
+        queued = 1;
+    }
+
+    for (int cls = 0; cls < JD_TX_NUM_CLASSES; ++cls) {
+        uint16_t depth = 0;
+        for (int i = 0; i < JD_TX_QUEUE_SIZE; ++i)
+            if (frameClass[i] == cls && frameState[i] == TXQ_QUEUED)
+                depth++;
+        classStats[cls].depth = depth;
+        if (depth > classStats[cls].max_depth)
+            classStats[cls].max_depth = depth;
+    }
+
+    if (queued)
+        jd_packet_ready();
+}
+
+jd_tx_class_stats_t *jd_tx_get_stats(void) {
+    return classStats;
 }
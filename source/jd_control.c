@@ -49,13 +49,15 @@ static void set_flood(srv_t *state, uint32_t num) {
 static void process_flood(srv_t *state) {
     if (state->flood_remaining && jd_tx_is_idle()) {
         uint32_t len = 4 + state->flood_size;
-        uint8_t tmp[len];
-        memcpy(tmp, &state->flood_counter, 4);
-        for (uint32_t i = 4; i < len; ++i)
-            tmp[i] = i - 4;
+        uint8_t *dst = jd_send_reserve(JD_SERVICE_INDEX_CONTROL, JD_CONTROL_CMD_FLOOD_PING, len);
+        if (dst) {
+            memcpy(dst, &state->flood_counter, 4);
+            for (uint32_t i = 4; i < len; ++i)
+                dst[i] = i - 4;
+            jd_send_commit();
+        }
         state->flood_counter++;
         set_flood(state, state->flood_remaining - 1);
-        jd_send(JD_SERVICE_INDEX_CONTROL, JD_CONTROL_CMD_FLOOD_PING, tmp, len);
     }
 }
 #else
@@ -66,6 +68,67 @@ static void process_flood(srv_t *state) {}
 extern const char app_spec_url[];
 #endif
 
+#if JD_CONFIG_SERVICE_PROFILE == 1
+static void send_profile(jd_packet_t *pkt) {
+    unsigned first = pkt->service_size >= 1 ? pkt->data[0] : 0;
+    unsigned flags = pkt->service_size >= 2 ? pkt->data[1] : 0;
+
+    unsigned num = 0;
+    while (jd_services_profile(num))
+        num++;
+    if (first > num)
+        first = num;
+    unsigned n = num - first;
+    unsigned max = (JD_SERIAL_PAYLOAD_SIZE - 4) / sizeof(jd_service_profile_t);
+    if (n > max)
+        n = max;
+
+    uint8_t *dst = jd_send_reserve(JD_SERVICE_INDEX_CONTROL, JD_CONTROL_CMD_SERVICE_PROFILE,
+                                   4 + n * sizeof(jd_service_profile_t));
+    if (dst) {
+        dst[0] = first;
+        dst[1] = num;
+        dst[2] = dst[3] = 0;
+        for (unsigned i = 0; i < n; ++i)
+            memcpy(dst + 4 + i * sizeof(jd_service_profile_t), jd_services_profile(first + i),
+                   sizeof(jd_service_profile_t));
+        jd_send_commit();
+    }
+
+    if (flags & JD_CONTROL_SERVICE_PROFILE_RESET)
+        for (unsigned i = 0; i < num; ++i)
+            memset(jd_services_profile(i), 0, sizeof(jd_service_profile_t));
+}
+#endif
+
+static void send_heap_usage(jd_packet_t *pkt) {
+    unsigned num = 0;
+    while (jd_services_heap(num))
+        num++;
+    unsigned max = (JD_SERIAL_PAYLOAD_SIZE - sizeof(jd_control_heap_usage_t)) / 4;
+    if (num > max)
+        num = max;
+
+    jd_control_heap_usage_t *dst = jd_send_reserve(
+        JD_SERVICE_INDEX_CONTROL, pkt->service_command, sizeof(jd_control_heap_usage_t) + num * 4);
+    if (!dst)
+        return;
+    jd_alloc_stats_t *st = jd_alloc_get_stats();
+    dst->heap_size = st->heap_size;
+    dst->in_use = st->in_use;
+    dst->max_in_use = st->max_in_use;
+    dst->available = st->never_used;
+    dst->max_stack = st->max_stack;
+    dst->num_services = num;
+    uint16_t *p = (uint16_t *)(dst + 1);
+    for (unsigned i = 0; i < num; ++i) {
+        jd_service_heap_t *h = jd_services_heap(i);
+        p[2 * i] = h->in_use > 0xffff ? 0xffff : h->in_use;
+        p[2 * i + 1] = h->max_in_use > 0xffff ? 0xffff : h->max_in_use;
+    }
+    jd_send_commit();
+}
+
 void jd_ctrl_process(srv_t *state) {
 #if JD_CONFIG_IDENTIFY == 1
     identify(state);
@@ -75,6 +138,21 @@ void jd_ctrl_process(srv_t *state) {
     if (state->watchdog && in_past(state->watchdog))
         target_reset();
 #endif
+
+#if JD_CONFIG_CONTROL_FLOOD == 1
+    // nothing tells us when the TX queue becomes idle, so keep polling
+    if (state->flood_remaining)
+        return;
+#endif
+    jd_services_wake_on_packet(state);
+#if JD_CONFIG_IDENTIFY == 1
+    if (state->id_counter)
+        jd_services_wake_at(state, state->nextblink);
+#endif
+#if JD_CONFIG_WATCHDOG == 1
+    if (state->watchdog)
+        jd_services_wake_at(state, state->watchdog);
+#endif
 }
 
 void jd_ctrl_handle_packet(srv_t *state, jd_packet_t *pkt) {
@@ -132,6 +210,21 @@ void jd_ctrl_handle_packet(srv_t *state, jd_packet_t *pkt) {
         break;
     }
 
+    case JD_GET(JD_CONTROL_REG_BUS_DIAGNOSTICS):
+        jd_send(JD_SERVICE_INDEX_CONTROL, pkt->service_command, jd_get_diagnostics(),
+                sizeof(jd_diagnostics_t));
+        break;
+
+    case JD_GET(JD_CONTROL_REG_HEAP_USAGE):
+        send_heap_usage(pkt);
+        break;
+
+#if JD_CONFIG_SERVICE_PROFILE == 1
+    case JD_CONTROL_CMD_SERVICE_PROFILE:
+        send_profile(pkt);
+        break;
+#endif
+
 #if JD_CONFIG_DEV_SPEC_URL == 1
     case JD_GET(JD_CONTROL_REG_DEVICE_SPECIFICATION_URL):
         jd_send(JD_SERVICE_INDEX_CONTROL, pkt->service_command, app_spec_url,
@@ -11,22 +11,55 @@
 #define JD_STATUS_TX_ACTIVE 0x02
 #define JD_STATUS_TX_QUEUED 0x04
 
-static jd_frame_t _rxBuffer[2];
-static jd_frame_t *rxFrame = &_rxBuffer[0];
+// owned by the RX queue
+static jd_frame_t *rxFrame;
 static void set_tick_timer(uint8_t statusClear);
 static volatile uint8_t status;
 
+// CRC of the first rxCrcPos bytes of rxFrame (starting at offset 2), see jd_rx_data_received()
+static uint16_t rxCrc;
+static uint16_t rxCrcPos;
+
 static jd_frame_t *txFrame;
 static uint64_t nextAnnounce;
 static uint8_t txPending;
+#if JD_CONFIG_TX_BACKOFF == JD_TX_BACKOFF_ADAPTIVE
+static uint8_t txBackoffExp;
+// lost a race since the last frame sent - the next losses of the same frame don't count
+static uint8_t txLost;
+// when txBackoffExp last went up, or last decayed
+static uint32_t txBackoffTime;
+#endif
 
 static jd_diagnostics_t jd_diagnostics;
 
+#if JD_CONFIG_BUS_STATS == 1
+static uint32_t rxStartTime, txStartTime;
+#define BUS_STATS_START(v) v = (uint32_t)tim_get_micros()
+#define BUS_STATS_END(v, counter) jd_diagnostics.counter += (uint32_t)tim_get_micros() - v
+#else
+#define BUS_STATS_START(v) ((void)0)
+#define BUS_STATS_END(v, counter) ((void)0)
+#endif
+
 jd_diagnostics_t *jd_get_diagnostics(void) {
-    jd_diagnostics.bus_state = 0; // TODO?
+    jd_diagnostics.bus_state = status;
     return &jd_diagnostics;
 }
 
+void jd_diagnostics_hist_add(uint16_t *hist, uint32_t us) {
+    unsigned b = 0;
+    for (us >>= 7; us && b < JD_DIAG_HIST_BUCKETS - 1; us >>= 1)
+        b++;
+    if (hist[b] != 0xffff)
+        hist[b]++;
+}
+
+void jd_diagnostics_irq_section(uint32_t ns) {
+    if (ns > jd_diagnostics.irq_disabled_max_ns)
+        jd_diagnostics.irq_disabled_max_ns = ns;
+}
+
 int jd_is_running(void) {
     return nextAnnounce != 0;
 }
@@ -35,6 +68,42 @@ int jd_is_busy(void) {
     return status != 0;
 }
 
+#if JD_CONFIG_TX_BACKOFF == JD_TX_BACKOFF_ADAPTIVE
+static void tx_contention(int lost) {
+    if (lost) {
+        if (txLost)
+            return;
+        txLost = 1;
+        if (txBackoffExp < JD_TX_BACKOFF_MAX_EXP)
+            txBackoffExp++;
+        txBackoffTime = (uint32_t)tim_get_micros();
+    } else {
+        if (!txLost && txBackoffExp)
+            txBackoffExp--;
+        txLost = 0;
+    }
+}
+
+static uint32_t tx_backoff_us(void) {
+    if (txBackoffExp) {
+        // one step down for every JD_TX_BACKOFF_DECAY_US since it last went up
+        uint32_t steps = ((uint32_t)tim_get_micros() - txBackoffTime) / JD_TX_BACKOFF_DECAY_US;
+        if (steps >= txBackoffExp)
+            txBackoffExp = 0;
+        else
+            txBackoffExp -= steps;
+        txBackoffTime += steps * JD_TX_BACKOFF_DECAY_US;
+    }
+    uint32_t r = jd_random_around(150);
+    if (txBackoffExp)
+        r += jd_random() & ((128 << txBackoffExp) - 1);
+    return r;
+}
+#else
+#define tx_contention(lost) ((void)0)
+#define tx_backoff_us() jd_random_around(150)
+#endif
+
 static void tx_done(void) {
 #ifdef JD_DEBUG_MODE
     jd_debug_signal_write(0);
@@ -44,8 +113,10 @@ static void tx_done(void) {
 
 void jd_tx_completed(int errCode) {
     LOG("tx done: %d", errCode);
+    BUS_STATS_END(txStartTime, bus_tx_us);
     jd_tx_frame_sent(txFrame);
     txFrame = NULL;
+    tx_contention(0);
     tx_done();
 }
 
@@ -76,9 +147,11 @@ static void flush_tx_queue(void) {
     jd_debug_signal_write(1);
 #endif
 
+    BUS_STATS_START(txStartTime);
     if (uart_start_tx(txFrame, JD_FRAME_SIZE(txFrame)) < 0) {
         // ERROR("race on TX");
         jd_diagnostics.bus_lo_error++;
+        tx_contention(1);
         tx_done();
         txPending = 1;
         return;
@@ -100,7 +173,7 @@ static void set_tick_timer(uint8_t statusClear) {
             // (when the line below is uncommented)
             // tim_set_timer(150 - JD_WR_OVERHEAD, flush_tx_queue);
             status |= JD_STATUS_TX_QUEUED;
-            tim_set_timer(jd_random_around(150) - JD_WR_OVERHEAD, flush_tx_queue);
+            tim_set_timer(tx_backoff_us() - JD_WR_OVERHEAD, flush_tx_queue);
         } else {
             status &= ~JD_STATUS_TX_QUEUED;
             tim_set_timer(10000, tick);
@@ -112,6 +185,7 @@ static void set_tick_timer(uint8_t statusClear) {
 static void rx_timeout(void) {
     target_disable_irq();
     jd_diagnostics.bus_timeout_error++;
+    BUS_STATS_END(rxStartTime, bus_rx_us);
     ERROR("RX t/o");
     uart_disable();
 #ifdef JD_DEBUG_MODE
@@ -151,7 +225,13 @@ void jd_line_falling() {
     // no need to disable IRQ - we're at the highest IRQ level
     if (status & JD_STATUS_RX_ACTIVE)
         jd_panic();
+    // someone else started transmitting while we were waiting to
+    if (status & JD_STATUS_TX_QUEUED)
+        tx_contention(1);
     status |= JD_STATUS_RX_ACTIVE;
+    BUS_STATS_START(rxStartTime);
+
+    rxFrame = jd_rx_get_free_frame();
 
     // 1us faster than memset() on SAMD21
     uint32_t *p = (uint32_t *)rxFrame;
@@ -160,6 +240,9 @@ void jd_line_falling() {
     p[2] = 0;
     p[3] = 0;
 
+    rxCrc = jd_crc16_init();
+    rxCrcPos = 2;
+
     // otherwise we can enable RX in the middle of LO pulse
     if (uart_wait_high() < 0) {
         // line didn't get high in 1ms or so - bail out
@@ -178,9 +261,23 @@ void jd_line_falling() {
     // target_enable_irq();
 }
 
+void jd_rx_data_received(uint32_t numbytes) {
+    // need the size byte to know where the CRC ends
+    if (!(status & JD_STATUS_RX_ACTIVE) || numbytes < 3)
+        return;
+    uint32_t declaredSize = JD_FRAME_SIZE(rxFrame);
+    if (numbytes > declaredSize)
+        numbytes = declaredSize;
+    if (numbytes > rxCrcPos) {
+        rxCrc = jd_crc16_update(rxCrc, (uint8_t *)rxFrame + rxCrcPos, numbytes - rxCrcPos);
+        rxCrcPos = numbytes;
+    }
+}
+
 void jd_rx_completed(int dataLeft) {
     LOG("rx cmpl");
     jd_frame_t *frame = rxFrame;
+    BUS_STATS_END(rxStartTime, bus_rx_us);
 
 #ifdef JD_DEBUG_MODE
     jd_debug_signal_read(0);
@@ -201,7 +298,9 @@ void jd_rx_completed(int dataLeft) {
         jd_diagnostics.bus_uart_error++;
         return;
     }
-    uint16_t crc = jd_crc16((uint8_t *)frame + 2, declaredSize - 2);
+    uint16_t crc =
+        jd_crc16_update(rxCrc, (uint8_t *)frame + rxCrcPos, declaredSize - rxCrcPos);
+    crc = jd_crc16_final(crc);
     if (crc != frame->crc) {
         ERROR("crc err");
         jd_diagnostics.bus_uart_error++;
@@ -213,20 +312,25 @@ void jd_rx_completed(int dataLeft) {
         return;
     }
 
+#if JD_CONFIG_RX_FILTER
+    if (!jd_services_wants_frame(frame)) {
+        jd_diagnostics.packets_filtered++;
+        return;
+    }
+#endif
+
     jd_diagnostics.packets_received++;
 
-    // only swap frames just before we're about to process
-    // no reason to swap frames that are dropped above
-    if (rxFrame == &_rxBuffer[0])
-        rxFrame = &_rxBuffer[1];
-    else
-        rxFrame = &_rxBuffer[0];
+#if JD_CONFIG_ANNOUNCE_IRQ == 1
+    if (jd_services_announce_irq(frame))
+        return;
+#endif
 
     // pulse1();
     int err = jd_rx_frame_received(frame);
 
     if (err)
-        jd_diagnostics.packets_dropped++;
+        jd_diagnostics.rx_queue_overflow++;
 }
 
 void jd_packet_ready(void) {
@@ -6,15 +6,129 @@
 // #define LOG JD_LOG
 #define LOG JD_NOLOG
 
-#define MAX_SERV 32
+#define MAX_SERV JD_CONFIG_MAX_SERVICES
 
 #define IN_SERV_INIT 0xff
 #define IN_SERV_SLEEP 0xfe
 
+#if JD_CONFIG_STATIC_SERVICES == 1
+// per-service tables (indexed by service_index) point into static arrays
+#define SRV_TABLE_DEF(type, name) static type *name, name##_storage[MAX_SERV]
+#define SRV_TABLE_ALLOC(name)                                                                      \
+    do {                                                                                           \
+        name = name##_storage;                                                                     \
+        memset(name, 0, sizeof(name##_storage));                                                   \
+    } while (0)
+// service states, one after another
+static void *srv_arena[JD_CONFIG_SERVICE_ARENA_SIZE / sizeof(void *)];
+static uint32_t srv_arena_used;
+static srv_t *services_storage[MAX_SERV];
+#else
+#define SRV_TABLE_DEF(type, name) static type *name
+#define SRV_TABLE_ALLOC(name) name = jd_alloc(sizeof(*name) * num_services)
+#endif
+
 static srv_t **services;
-static uint8_t num_services, reset_counter, packets_sent;
+// service classes sorted ascending (services of the same class by index), for broadcasts
+typedef struct {
+    uint32_t service_class;
+    uint8_t service_index;
+} srv_class_t;
+SRV_TABLE_DEF(srv_class_t, service_classes);
+static uint8_t num_services, reset_counter;
+// packets queued since the last announce; with JD_CONFIG_ANNOUNCE_IRQ, also read and reset by
+// jd_services_announce_irq(), so the main loop only touches it with IRQs disabled (ANNOUNCE_LOCK())
+static uint8_t packets_sent;
 static uint8_t curr_service_process;
 static uint32_t lastMax, lastDisconnectBlink, nextAnnounce;
+// JD_CONTROL_CMD_SERVICES payload, built in jd_services_init(); only the first word (flags and
+// packet count, in place of the control service class) changes between announces
+static uint16_t announce_flags;
+#if JD_CONFIG_ANNOUNCE_IRQ == 1
+// the whole frame, sent from IRQ; announce_data points into it
+static uint32_t *announce_data;
+static jd_frame_t *announce_frame;
+#if JD_CONFIG_STATIC_SERVICES == 1
+static jd_frame_t announce_frame_storage;
+#endif
+#else
+SRV_TABLE_DEF(uint32_t, announce_data);
+#endif
+
+// scheduling hints from jd_services_wake_at() and friends; indexed by service_index
+#define SCHED_EVERY_TICK 0
+#define SCHED_AT 1
+#define SCHED_ON_PACKET 2
+SRV_TABLE_DEF(uint8_t, srv_sched);
+SRV_TABLE_DEF(uint32_t, srv_wakeup);
+// earliest deadline of the last jd_services_tick()
+static uint32_t tick_wakeup;
+
+#if JD_CONFIG_SERVICE_PROFILE == 1
+SRV_TABLE_DEF(jd_service_profile_t, profiles);
+
+static void profile_add(jd_profile_counter_t *c, uint32_t t0) {
+    uint32_t dt = JD_PROFILE_CLOCK() - t0;
+    c->calls++;
+    c->time += dt;
+    if (dt > c->max_time)
+        c->max_time = dt;
+}
+#define PROFILE_START() uint32_t profile_t0 = JD_PROFILE_CLOCK()
+#define PROFILE_END(idx, kind) profile_add(&profiles[idx].kind, profile_t0)
+#else
+#define PROFILE_START() ((void)0)
+#define PROFILE_END(idx, kind) ((void)0)
+#endif
+
+jd_service_profile_t *jd_services_profile(unsigned service_index) {
+#if JD_CONFIG_SERVICE_PROFILE == 1
+    if (profiles && service_index < num_services)
+        return &profiles[service_index];
+#endif
+    return NULL;
+}
+
+#if JD_CONFIG_ALLOC_TAGS == 1
+// not allocated, as services allocate before jd_services_init() knows how many there are
+static jd_service_heap_t srv_heap[MAX_SERV];
+// service running, for jd_alloc_tag_charge()
+static uint8_t alloc_tag = JD_ALLOC_TAG_NONE;
+
+uint8_t jd_alloc_tag_charge(uint32_t size) {
+    if (alloc_tag != JD_ALLOC_TAG_NONE) {
+        jd_service_heap_t *h = &srv_heap[alloc_tag];
+        h->in_use += size;
+        if (h->in_use > h->max_in_use)
+            h->max_in_use = h->in_use;
+    }
+    return alloc_tag;
+}
+
+void jd_alloc_tag_release(uint8_t tag, uint32_t size) {
+    if (tag < MAX_SERV)
+        srv_heap[tag].in_use -= size;
+}
+
+// nested, when a service calls jd_services_sleep_us()
+#define ALLOC_TAG_PUSH(idx)                                                                        \
+    uint8_t prev_alloc_tag = alloc_tag;                                                            \
+    alloc_tag = (idx)
+#define ALLOC_TAG_POP() alloc_tag = prev_alloc_tag
+#define ALLOC_TAG_SET(idx) alloc_tag = (idx)
+#else
+#define ALLOC_TAG_PUSH(idx) ((void)0)
+#define ALLOC_TAG_POP() ((void)0)
+#define ALLOC_TAG_SET(idx) ((void)0)
+#endif
+
+jd_service_heap_t *jd_services_heap(unsigned service_index) {
+#if JD_CONFIG_ALLOC_TAGS == 1
+    if (service_index < num_services)
+        return &srv_heap[service_index];
+#endif
+    return NULL;
+}
 
 struct srv_state {
     SRV_COMMON;
@@ -38,30 +152,35 @@ int service_handle_register_final(srv_t *state, jd_packet_t *pkt, const uint16_t
     return r;
 }
 
-int service_handle_register(srv_t *state, jd_packet_t *pkt, const uint16_t sdesc[]) {
-    bool is_get = (pkt->service_command >> 12) == (JD_CMD_GET_REGISTER >> 12);
-    bool is_set = (pkt->service_command >> 12) == (JD_CMD_SET_REGISTER >> 12);
-    if (!is_get && !is_set)
-        return 0;
+#define REG_FLAG_NOTIFY 0x01
 
-    if (is_set && pkt->service_size == 0)
-        return 0;
+typedef struct {
+    uint16_t code;
+    uint8_t type;
+    uint8_t bitoffset;
+    uint16_t offset;
+    uint8_t size;
+    uint8_t flags;
+} reg_layout_t;
 
-    int reg = pkt->service_command & 0xfff;
-
-    if (reg >= 0xf00) // these are reserved
-        return 0;
-
-    if (is_set && (reg & 0xf00) == 0x100)
-        return 0; // these are read-only
+#define REG_LAYOUT_ALL -1
+#define REG_LAYOUT_NOTIFY -2
 
+// computes offsets of registers in 'sdesc'; if 'reg' is REG_LAYOUT_ALL (or REG_LAYOUT_NOTIFY),
+// stores all of them (only the ones marked with REG_NOTIFY()) in 'dst' (if not NULL) and returns
+// their number, otherwise stores just 'reg' and returns 1 if found
+static int reg_layout(const uint16_t sdesc[], int reg, reg_layout_t *dst) {
     uint32_t offset = 0;
     uint8_t bitoffset = 0;
-
-    LOG("handle %x", reg);
+    int num = 0;
+    uint8_t flags = 0;
 
     for (int i = 0; sdesc[i] != JD_REG_END; ++i) {
         uint16_t sd = sdesc[i];
+        if (sd == JD_REG_NOTIFY) {
+            flags |= REG_FLAG_NOTIFY;
+            continue;
+        }
         int tp = sd >> 12;
         int regsz = regSize[tp];
 
@@ -82,38 +201,20 @@ int service_handle_register(srv_t *state, jd_packet_t *pkt, const uint16_t sdesc
 
         LOG("%x:%d:%d", (sd & 0xfff), offset, regsz);
 
-        if ((sd & 0xfff) == reg) {
-            uint8_t *sptr = (uint8_t *)state + offset;
-            if (is_get) {
-                if (tp == _REG_BIT) {
-                    uint8_t v = *sptr & (1 << bitoffset) ? 1 : 0;
-                    jd_send(pkt->service_index, pkt->service_command, &v, 1);
-                } else {
-                    if (REG_IS_OPT(tp) && is_zero(sptr, regsz))
-                        return 0;
-                    jd_send(pkt->service_index, pkt->service_command, sptr, regsz);
-                }
-                return -reg;
-            } else {
-                if (tp == _REG_BIT) {
-                    LOG("bit @%d - %x", offset, reg);
-                    if (pkt->data[0])
-                        *sptr |= 1 << bitoffset;
-                    else
-                        *sptr &= ~(1 << bitoffset);
-                } else if (regsz <= pkt->service_size) {
-                    LOG("exact @%d - %x", offset, reg);
-                    memcpy(sptr, pkt->data, regsz);
-                } else {
-                    LOG("too little @%d - %x", offset, reg);
-                    memcpy(sptr, pkt->data, pkt->service_size);
-                    int fill = !REG_IS_SIGNED(tp)                          ? 0
-                               : (pkt->data[pkt->service_size - 1] & 0x80) ? 0xff
-                                                                           : 0;
-                    memset(sptr + pkt->service_size, fill, regsz - pkt->service_size);
-                }
-                return reg;
+        if (reg == REG_LAYOUT_ALL || (reg == REG_LAYOUT_NOTIFY && (flags & REG_FLAG_NOTIFY)) ||
+            (sd & 0xfff) == reg) {
+            if (dst) {
+                reg_layout_t *l = &dst[reg < 0 ? num : 0];
+                l->code = sd & 0xfff;
+                l->type = tp;
+                l->bitoffset = bitoffset;
+                l->offset = offset;
+                l->size = regsz;
+                l->flags = flags;
             }
+            num++;
+            if (reg >= 0)
+                return 1;
         }
 
         if (tp == _REG_BIT) {
@@ -125,9 +226,157 @@ int service_handle_register(srv_t *state, jd_packet_t *pkt, const uint16_t sdesc
         } else {
             offset += regsz;
         }
+        flags = 0;
     }
 
-    return 0;
+    return reg < 0 ? num : 0;
+}
+
+#if JD_CONFIG_REG_INDEX == 1
+// layout of a REG_DEFINITION(), sorted by register code; built by service_index_registers()
+typedef struct reg_index {
+    struct reg_index *next;
+    const uint16_t *sdesc;
+    uint16_t num_regs;
+    reg_layout_t regs[0];
+} reg_index_t;
+// all of them, shared between services with the same definition
+static reg_index_t *reg_indices;
+// the one of every service, so that a lookup doesn't have to search; indexed by service_index
+static reg_index_t *srv_reg_index[MAX_SERV];
+
+static reg_index_t *find_reg_index(const uint16_t sdesc[]) {
+    reg_index_t *idx = reg_indices;
+    while (idx && idx->sdesc != sdesc)
+        idx = idx->next;
+    return idx;
+}
+
+static reg_index_t *build_reg_index(const uint16_t sdesc[]) {
+    int num = reg_layout(sdesc, REG_LAYOUT_ALL, NULL);
+    reg_index_t *idx = jd_alloc(sizeof(reg_index_t) + num * sizeof(reg_layout_t));
+    reg_layout(sdesc, REG_LAYOUT_ALL, idx->regs);
+
+    // insertion sort; drop reserved codes (padding), and keep the first of any duplicates,
+    // same as the linear search would
+    int n = 0;
+    for (int i = 0; i < num; ++i) {
+        reg_layout_t l = idx->regs[i];
+        if (l.code >= 0xf00)
+            continue;
+        int j = n;
+        while (j > 0 && idx->regs[j - 1].code > l.code)
+            j--;
+        if (j > 0 && idx->regs[j - 1].code == l.code)
+            continue;
+        memmove(&idx->regs[j + 1], &idx->regs[j], (n - j) * sizeof(reg_layout_t));
+        idx->regs[j] = l;
+        n++;
+    }
+
+    idx->num_regs = n;
+    idx->sdesc = sdesc;
+    idx->next = reg_indices;
+    reg_indices = idx;
+    return idx;
+}
+
+void service_index_registers(srv_t *state, const uint16_t sdesc[]) {
+    if (state->service_index >= MAX_SERV)
+        jd_panic();
+    reg_index_t *idx = find_reg_index(sdesc);
+    if (!idx)
+        idx = build_reg_index(sdesc);
+    srv_reg_index[state->service_index] = idx;
+}
+
+static const reg_layout_t *find_reg(srv_t *state, const uint16_t sdesc[], int reg,
+                                    reg_layout_t *tmp) {
+    reg_index_t *idx = state->service_index < MAX_SERV ? srv_reg_index[state->service_index] : NULL;
+    if (!idx || idx->sdesc != sdesc) // not indexed in init; never allocate here
+        return reg_layout(sdesc, reg, tmp) ? tmp : NULL;
+
+    int l = 0, r = idx->num_regs - 1;
+    while (l <= r) {
+        int m = (l + r) >> 1;
+        int code = idx->regs[m].code;
+        if (code == reg)
+            return &idx->regs[m];
+        if (code < reg)
+            l = m + 1;
+        else
+            r = m - 1;
+    }
+    return NULL;
+}
+#else
+void service_index_registers(srv_t *state, const uint16_t sdesc[]) {}
+
+static const reg_layout_t *find_reg(srv_t *state, const uint16_t sdesc[], int reg,
+                                    reg_layout_t *tmp) {
+    return reg_layout(sdesc, reg, tmp) ? tmp : NULL;
+}
+#endif
+
+int service_handle_register(srv_t *state, jd_packet_t *pkt, const uint16_t sdesc[]) {
+    bool is_get = (pkt->service_command >> 12) == (JD_CMD_GET_REGISTER >> 12);
+    bool is_set = (pkt->service_command >> 12) == (JD_CMD_SET_REGISTER >> 12);
+    if (!is_get && !is_set)
+        return 0;
+
+    if (is_set && pkt->service_size == 0)
+        return 0;
+
+    int reg = pkt->service_command & 0xfff;
+
+    if (reg >= 0xf00) // these are reserved
+        return 0;
+
+    if (is_set && (reg & 0xf00) == 0x100)
+        return 0; // these are read-only
+
+    LOG("handle %x", reg);
+
+    reg_layout_t tmp;
+    const reg_layout_t *l = find_reg(state, sdesc, reg, &tmp);
+    if (!l)
+        return 0;
+
+    int tp = l->type;
+    int regsz = l->size;
+    uint8_t bitoffset = l->bitoffset;
+    uint8_t *sptr = (uint8_t *)state + l->offset;
+
+    if (is_get) {
+        if (tp == _REG_BIT) {
+            uint8_t v = *sptr & (1 << bitoffset) ? 1 : 0;
+            jd_send(pkt->service_index, pkt->service_command, &v, 1);
+        } else {
+            if (REG_IS_OPT(tp) && is_zero(sptr, regsz))
+                return 0;
+            jd_send(pkt->service_index, pkt->service_command, sptr, regsz);
+        }
+        return -reg;
+    } else {
+        if (tp == _REG_BIT) {
+            LOG("bit @%d - %x", l->offset, reg);
+            if (pkt->data[0])
+                *sptr |= 1 << bitoffset;
+            else
+                *sptr &= ~(1 << bitoffset);
+        } else if (regsz <= pkt->service_size) {
+            LOG("exact @%d - %x", l->offset, reg);
+            memcpy(sptr, pkt->data, regsz);
+        } else {
+            LOG("too little @%d - %x", l->offset, reg);
+            memcpy(sptr, pkt->data, pkt->service_size);
+            int fill = !REG_IS_SIGNED(tp)                          ? 0
+                       : (pkt->data[pkt->service_size - 1] & 0x80) ? 0xff
+                                                                   : 0;
+            memset(sptr + pkt->service_size, fill, regsz - pkt->service_size);
+        }
+        return reg;
+    }
 }
 
 void jd_services_process_frame(jd_frame_t *frame) {
@@ -151,7 +400,20 @@ srv_t *jd_allocate_service(const srv_vt_t *vt) {
     // always allocate instances idx - it should be stable when we disable some services
     if (num_services >= MAX_SERV)
         jd_panic();
+    // the state, and the rest of the init that called us, are charged to the service
+    ALLOC_TAG_SET(num_services);
+#if JD_CONFIG_STATIC_SERVICES == 1
+    uint32_t size = (vt->state_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (srv_arena_used + size > sizeof(srv_arena)) {
+        DMESG("! JD_CONFIG_SERVICE_ARENA_SIZE too small");
+        jd_panic();
+    }
+    srv_t *r = (srv_t *)((uint8_t *)srv_arena + srv_arena_used);
+    srv_arena_used += size;
+    memset(r, 0, size);
+#else
     srv_t *r = jd_alloc(vt->state_size);
+#endif
     r->vt = vt;
     r->service_index = num_services;
     // sleeping is allowed in service init
@@ -163,8 +425,13 @@ srv_t *jd_allocate_service(const srv_vt_t *vt) {
 
 void jd_services_init() {
     num_services = 0;
+#if JD_CONFIG_STATIC_SERVICES == 1
+    srv_arena_used = 0;
+    services = services_storage;
+#else
     srv_t *tmp[MAX_SERV];
     services = tmp;
+#endif
 
     jd_ctrl_init();
 #ifdef JD_CONSOLE
@@ -172,45 +439,122 @@ void jd_services_init() {
 #endif
     app_init_services();
     curr_service_process = 0;
+    ALLOC_TAG_SET(JD_ALLOC_TAG_NONE);
+#if JD_CONFIG_STATIC_SERVICES == 1
+    LOG("service arena: %d of %d bytes", (int)srv_arena_used, (int)sizeof(srv_arena));
+#else
     services = jd_alloc(sizeof(void *) * num_services);
     memcpy(services, tmp, sizeof(void *) * num_services);
+#endif
+
+    SRV_TABLE_ALLOC(srv_sched);
+    SRV_TABLE_ALLOC(srv_wakeup);
+#if JD_CONFIG_SERVICE_PROFILE == 1
+    SRV_TABLE_ALLOC(profiles);
+#endif
+
+    SRV_TABLE_ALLOC(service_classes);
+    for (int i = 0; i < num_services; ++i) {
+        uint32_t cls = services[i]->vt->service_class;
+        int j = i;
+        while (j > 0 && service_classes[j - 1].service_class > cls) {
+            service_classes[j] = service_classes[j - 1];
+            j--;
+        }
+        service_classes[j].service_class = cls;
+        service_classes[j].service_index = i;
+    }
+
+    announce_flags = JD_CONTROL_ANNOUNCE_FLAGS_SUPPORTS_ACK |
+                     JD_CONTROL_ANNOUNCE_FLAGS_SUPPORTS_BROADCAST |
+                     JD_CONTROL_ANNOUNCE_FLAGS_SUPPORTS_FRAMES;
+#if JD_CONFIG_STATUS == 1
+#ifdef PIN_LED_R
+    announce_flags |= JD_CONTROL_ANNOUNCE_FLAGS_STATUS_LIGHT_RGB_FADE;
+#else
+    announce_flags |= JD_CONTROL_ANNOUNCE_FLAGS_STATUS_LIGHT_MONO;
+#endif
+#endif
+
+#if JD_CONFIG_ANNOUNCE_IRQ == 1
+#if JD_CONFIG_STATIC_SERVICES == 1
+    announce_frame = &announce_frame_storage;
+#else
+    announce_frame = jd_alloc(sizeof(jd_frame_t));
+#endif
+    jd_reset_frame(announce_frame);
+    announce_data = jd_push_in_frame(announce_frame, JD_SERVICE_INDEX_CONTROL,
+                                     JD_CONTROL_CMD_SERVICES, num_services * 4);
+    announce_frame->device_identifier = jd_device_id();
+#else
+    SRV_TABLE_ALLOC(announce_data);
+#endif
+    for (int i = 1; i < num_services; ++i)
+        announce_data[i] = services[i]->vt->service_class;
 
     // don't flash red initially
     lastDisconnectBlink = tim_get_micros() + 1000000;
 }
 
+#if JD_CONFIG_ANNOUNCE_IRQ == 1
+#define ANNOUNCE_LOCK() target_disable_irq()
+#define ANNOUNCE_UNLOCK() target_enable_irq()
+#else
+#define ANNOUNCE_LOCK() ((void)0)
+#define ANNOUNCE_UNLOCK() ((void)0)
+#endif
+
 void jd_services_packet_queued() {
+    ANNOUNCE_LOCK();
     packets_sent++;
+    ANNOUNCE_UNLOCK();
 }
 
 void jd_services_announce() {
-    jd_alloc_stack_check();
-
-    uint32_t dst[num_services];
-    for (int i = 0; i < num_services; ++i)
-        dst[i] = services[i]->vt->service_class;
     if (reset_counter < JD_CONTROL_ANNOUNCE_FLAGS_RESTART_COUNTER_STEADY)
         reset_counter++;
 
-    uint16_t adflags = reset_counter;
-#if JD_CONFIG_STATUS == 1
-#ifdef PIN_LED_R
-    adflags |= JD_CONTROL_ANNOUNCE_FLAGS_STATUS_LIGHT_RGB_FADE;
-#else
-    adflags |= JD_CONTROL_ANNOUNCE_FLAGS_STATUS_LIGHT_MONO;
-#endif
-#endif
-
-    adflags |= JD_CONTROL_ANNOUNCE_FLAGS_SUPPORTS_ACK |
-               JD_CONTROL_ANNOUNCE_FLAGS_SUPPORTS_BROADCAST |
-               JD_CONTROL_ANNOUNCE_FLAGS_SUPPORTS_FRAMES;
-
-    dst[0] = adflags | ((packets_sent + 1) << 16);
-
-    if (jd_send(JD_SERVICE_INDEX_CONTROL, JD_CONTROL_CMD_SERVICES, dst, num_services * 4) == 0) {
+    uint32_t *dst =
+        jd_send_reserve(JD_SERVICE_INDEX_CONTROL, JD_CONTROL_CMD_SERVICES, num_services * 4);
+    if (dst) {
+        ANNOUNCE_LOCK();
+        dst[0] = announce_flags | reset_counter | ((packets_sent + 1) << 16);
         packets_sent = 0;
+        ANNOUNCE_UNLOCK();
+        memcpy(dst + 1, announce_data + 1, (num_services - 1) * 4);
+        jd_send_commit();
+    }
+}
+
+#if JD_CONFIG_ANNOUNCE_IRQ == 1
+// called by the physical layer (in IRQ) for every received frame
+int jd_services_announce_irq(jd_frame_t *frame) {
+    if (!announce_frame || !(frame->flags & JD_FRAME_FLAG_COMMAND))
+        return 0;
+    // only frames with nothing but the request
+    jd_packet_t *pkt = (jd_packet_t *)frame;
+    if (frame->size != 4 || pkt->service_index != JD_SERVICE_INDEX_CONTROL ||
+        pkt->service_command != JD_CONTROL_CMD_SERVICES)
+        return 0;
+    if (frame->flags & JD_FRAME_FLAG_IDENTIFIER_IS_SERVICE_CLASS) {
+        if (frame->device_identifier != JD_SERVICE_CLASS_CONTROL)
+            return 0;
+    } else if (frame->device_identifier != jd_device_id()) {
+        return 0;
     }
+    // the previous one (or another raw frame) still going out - let the main loop answer
+    if (rawFrame || rawFrameSending)
+        return 0;
+
+    // reset_counter is left to the periodic announces
+    announce_data[0] = announce_flags | reset_counter | ((packets_sent + 1) << 16);
+    packets_sent = 0;
+    jd_compute_crc(announce_frame);
+    rawFrame = announce_frame;
+    jd_packet_ready();
+    return 1;
 }
+#endif
 
 static void handle_ctrl_tick(jd_packet_t *pkt) {
     if (pkt->service_command == JD_CONTROL_CMD_SERVICES) {
@@ -225,12 +569,182 @@ static void handle_ctrl_tick(jd_packet_t *pkt) {
 __attribute__((weak)) void jd_app_handle_packet(jd_packet_t *pkt) {}
 __attribute__((weak)) void jd_app_handle_command(jd_packet_t *pkt) {}
 
+// registers marked with REG_NOTIFY() in a service, and their last reported values
+typedef struct reg_notify {
+    struct reg_notify *next;
+    srv_t *state;
+    uint8_t *snapshot;
+    uint8_t num_regs;
+    reg_layout_t regs[0];
+} reg_notify_t;
+static reg_notify_t *reg_notifications;
+
+static inline uint8_t *notify_snapshot(reg_notify_t *n) {
+    return n->snapshot;
+}
+
+// current value of register 'l' (bits are unpacked to a byte in 'tmp')
+static const uint8_t *reg_value(srv_t *state, const reg_layout_t *l, uint8_t *tmp) {
+    const uint8_t *sptr = (const uint8_t *)state + l->offset;
+    if (l->type != _REG_BIT)
+        return sptr;
+    *tmp = *sptr & (1 << l->bitoffset) ? 1 : 0;
+    return tmp;
+}
+
+void service_notify_registers(srv_t *state, const uint16_t sdesc[]) {
+    service_index_registers(state, sdesc);
+
+    // count, then lay out straight into the allocated table; the sizes are only known then,
+    // so the snapshot is allocated separately
+    int num_notify = reg_layout(sdesc, REG_LAYOUT_NOTIFY, NULL);
+    if (!num_notify)
+        return;
+    if (num_notify > 32)
+        jd_panic(); // see notify_changes()
+
+    reg_notify_t *n = jd_alloc(sizeof(reg_notify_t) + num_notify * sizeof(reg_layout_t));
+    n->state = state;
+    n->num_regs = reg_layout(sdesc, REG_LAYOUT_NOTIFY, n->regs);
+    int snapshot_size = 0;
+    for (int i = 0; i < num_notify; ++i)
+        snapshot_size += n->regs[i].size;
+    uint8_t *snap = n->snapshot = jd_alloc(snapshot_size);
+    for (int i = 0; i < num_notify; ++i) {
+        uint8_t tmp;
+        memcpy(snap, reg_value(state, &n->regs[i], &tmp), n->regs[i].size);
+        snap += n->regs[i].size;
+    }
+
+    n->next = reg_notifications;
+    reg_notifications = n;
+}
+
+// changes in one tick are coalesced into one report per service; whatever doesn't fit
+// (or can't be queued) keeps its old snapshot, and is reported on the next tick
+static void notify_changes(void) {
+    for (reg_notify_t *n = reg_notifications; n; n = n->next) {
+        uint8_t tmp;
+        uint8_t *snap = notify_snapshot(n);
+        unsigned size = 0;
+        uint32_t changed = 0;
+        for (int i = 0; i < n->num_regs; ++i) {
+            reg_layout_t *l = &n->regs[i];
+            unsigned esize = (l->size + 4 + 3) & ~3;
+            if (memcmp(snap, reg_value(n->state, l, &tmp), l->size) != 0 &&
+                size + esize <= JD_SERIAL_PAYLOAD_SIZE) {
+                changed |= 1u << i;
+                size += esize;
+            }
+            snap += l->size;
+        }
+        if (!changed)
+            continue;
+
+        uint8_t *dst = jd_send_reserve(n->state->service_index, JD_CMD_REGISTERS_CHANGED, size);
+        if (!dst)
+            continue;
+        memset(dst, 0, size);
+        snap = notify_snapshot(n);
+        for (int i = 0; i < n->num_regs; ++i) {
+            reg_layout_t *l = &n->regs[i];
+            if (changed & (1u << i)) {
+                const uint8_t *v = reg_value(n->state, l, &tmp);
+                dst[0] = l->size;
+                dst[1] = n->state->service_index;
+                dst[2] = JD_GET(l->code) & 0xff;
+                dst[3] = JD_GET(l->code) >> 8;
+                memcpy(dst + 4, v, l->size);
+                memcpy(snap, v, l->size);
+                dst += (l->size + 4 + 3) & ~3;
+            }
+            snap += l->size;
+        }
+        jd_send_commit();
+    }
+}
+
+// the packets in the batch are moved in place of 'pkt', one at a time; the ones that follow
+// are never overwritten, and the header of 'pkt' is restored afterwards, for jd_shift_frame()
+static void handle_batch(srv_t *s, jd_packet_t *pkt) {
+    uint8_t *hdr = &pkt->service_size;
+    uint8_t saved[4];
+    memcpy(saved, hdr, 4);
+
+    int size = saved[0];
+    int ptr = 0;
+    while (ptr + 4 <= size) {
+        int esize = hdr[4 + ptr] + 4;
+        if (ptr + esize > size)
+            break;
+        memmove(hdr, hdr + 4 + ptr, esize);
+        pkt->service_index = saved[1];
+        if (pkt->service_command != JD_CMD_REGISTER_BATCH)
+            s->vt->handle_pkt(s, pkt);
+        ptr += (esize + 3) & ~3;
+    }
+
+    memcpy(hdr, saved, 4);
+}
+
+// index in service_classes[] of the first service of class 'cls', or num_services if none
+static int find_service_class(uint32_t cls) {
+    int l = 0, r = num_services;
+    while (l < r) {
+        int m = (l + r) >> 1;
+        if (service_classes[m].service_class < cls)
+            l = m + 1;
+        else
+            r = m;
+    }
+    return l < num_services && service_classes[l].service_class == cls ? l : num_services;
+}
+
+// service_classes[] is only written in jd_services_init(), so this is safe to call from IRQ
+int jd_services_wants_frame(jd_frame_t *frame) {
+    if (!service_classes)
+        return 1; // still initializing
+
+    if (frame->flags & JD_FRAME_FLAG_COMMAND) {
+        if (frame->flags & JD_FRAME_FLAG_IDENTIFIER_IS_SERVICE_CLASS) {
+#if JD_CONFIG_RX_FILTER & JD_RX_FILTER_BROADCASTS
+            return (frame->device_identifier >> 32) == 0 &&
+                   find_service_class((uint32_t)frame->device_identifier) < num_services;
+#endif
+        } else {
+#if JD_CONFIG_RX_FILTER & JD_RX_FILTER_COMMANDS
+            return frame->device_identifier == jd_device_id();
+#endif
+        }
+        return 1;
+    }
+
+#if JD_CONFIG_RX_FILTER & JD_RX_FILTER_REPORTS
+    // keep announces and other control reports, see handle_ctrl_tick()
+    for (unsigned ptr = 0; ptr + 4 <= frame->size; ptr += (frame->data[ptr] + 4 + 3) & ~3) {
+        if (frame->data[ptr + 1] == JD_SERVICE_INDEX_CONTROL)
+            return 1;
+#if JD_CONFIG_EVENT_ACK == 1
+        if (frame->data[ptr + 1] == JD_SERVICE_INDEX_CRC_ACK)
+            return 1;
+#endif
+    }
+    return 0;
+#else
+    return 1;
+#endif
+}
+
 void jd_services_handle_packet(jd_packet_t *pkt) {
     jd_app_handle_packet(pkt);
 
     if (!(pkt->flags & JD_FRAME_FLAG_COMMAND)) {
         if (pkt->service_index == 0)
             handle_ctrl_tick(pkt);
+#if JD_CONFIG_EVENT_ACK == 1
+        else if (pkt->service_index == JD_SERVICE_INDEX_CRC_ACK)
+            jd_event_ack_received(pkt->service_command);
+#endif
         return;
     }
 
@@ -238,22 +752,88 @@ void jd_services_handle_packet(jd_packet_t *pkt) {
         jd_app_handle_command(pkt);
         if (pkt->service_index < num_services) {
             srv_t *s = services[pkt->service_index];
-            s->vt->handle_pkt(s, pkt);
+            srv_sched[pkt->service_index] = SCHED_EVERY_TICK;
+            ALLOC_TAG_PUSH(pkt->service_index);
+            PROFILE_START();
+            if (pkt->service_command == JD_CMD_REGISTER_BATCH)
+                handle_batch(s, pkt);
+            else
+                s->vt->handle_pkt(s, pkt);
+            PROFILE_END(pkt->service_index, packet);
+            ALLOC_TAG_POP();
         }
     } else if (pkt->flags & JD_FRAME_FLAG_IDENTIFIER_IS_SERVICE_CLASS) {
-        for (int i = 0; i < num_services; ++i) {
+        if (pkt->device_identifier >> 32)
+            return;
+        uint32_t cls = (uint32_t)pkt->device_identifier;
+        for (int l = find_service_class(cls);
+             l < num_services && service_classes[l].service_class == cls; ++l) {
+            int i = service_classes[l].service_index;
             srv_t *s = services[i];
-            if (pkt->device_identifier == s->vt->service_class) {
-                pkt->service_index = i;
-                s->vt->handle_pkt(s, pkt);
-            }
+            pkt->service_index = i;
+            srv_sched[i] = SCHED_EVERY_TICK;
+            ALLOC_TAG_PUSH(i);
+            PROFILE_START();
+            s->vt->handle_pkt(s, pkt);
+            PROFILE_END(i, packet);
+            ALLOC_TAG_POP();
         }
     }
 }
 
+static void wake_at(uint32_t when) {
+    if ((int32_t)(when - tick_wakeup) < 0)
+        tick_wakeup = when;
+}
+
+void jd_services_wake_at(srv_t *state, uint32_t when) {
+    if (!state) {
+        wake_at(when);
+        return;
+    }
+    if (!srv_sched)
+        return; // still in init; process() is called on the first tick anyway
+    int idx = ((srv_common_t *)state)->service_index;
+    if (srv_sched[idx] == SCHED_AT && (int32_t)(when - srv_wakeup[idx]) >= 0)
+        return;
+    srv_sched[idx] = SCHED_AT;
+    srv_wakeup[idx] = when;
+}
+
+void jd_services_wake_on_packet(srv_t *state) {
+    if (srv_sched)
+        srv_sched[((srv_common_t *)state)->service_index] = SCHED_ON_PACKET;
+}
+
+uint32_t jd_services_max_sleep(void) {
+    int32_t d = tick_wakeup - (uint32_t)tim_get_micros();
+    return d < 0 ? 0 : d;
+}
+
+// runs process() of service 'i', unless it asked not to be woken up yet
+static void process_service(int i) {
+    uint8_t sched = srv_sched[i];
+    if (sched == SCHED_ON_PACKET || (sched == SCHED_AT && in_future(srv_wakeup[i]))) {
+        if (sched == SCHED_AT)
+            wake_at(srv_wakeup[i]);
+        return;
+    }
+    // the hint only lasts until the next process(), which may give a new one
+    srv_sched[i] = SCHED_EVERY_TICK;
+    ALLOC_TAG_PUSH(i);
+    PROFILE_START();
+    services[i]->vt->process(services[i]);
+    PROFILE_END(i, process);
+    ALLOC_TAG_POP();
+    if (srv_sched[i] == SCHED_AT)
+        wake_at(srv_wakeup[i]);
+}
+
 void jd_services_tick() {
-    if (jd_should_sample(&nextAnnounce, 500000))
+    if (jd_should_sample(&nextAnnounce, 500000)) {
+        jd_alloc_stack_check();
         jd_services_announce();
+    }
 
     if (jd_should_sample(&lastDisconnectBlink, 2000000)) {
         if (!lastMax || in_past(lastMax + 2000000)) {
@@ -262,18 +842,23 @@ void jd_services_tick() {
         }
     }
 
+    // the framework itself has to run at least this often
+    tick_wakeup = nextAnnounce;
+    wake_at(lastDisconnectBlink);
+
     // do ctrl process regardless of sleep status
-    services[0]->vt->process(services[0]);
+    process_service(0);
 
     // while in sleep state, do not run any more nested process()
     if (curr_service_process != IN_SERV_SLEEP) {
         for (int i = 1; i < num_services; ++i) {
             curr_service_process = i;
-            services[i]->vt->process(services[i]);
+            process_service(i);
         }
         curr_service_process = 0;
     }
 
+    notify_changes();
     jd_process_event_queue();
 
 #if JD_CONFIG_STATUS == 1
@@ -284,9 +869,11 @@ void jd_services_tick() {
 }
 
 static void jd_process_everything_core(void) {
-    jd_frame_t *fr = jd_rx_get_frame();
-    if (fr)
+    jd_frame_t *fr;
+    while ((fr = jd_rx_get_frame()) != NULL) {
         jd_services_process_frame(fr);
+        jd_rx_release_frame(fr);
+    }
 
     jd_services_tick();
     app_process();
@@ -49,23 +49,6 @@ uint32_t jd_random_around(uint32_t v) {
     return (v - (mask >> 1)) + (jd_random() & mask);
 }
 
-// https://wiki.nicksoft.info/mcu:pic16:crc-16:home
-uint16_t jd_crc16(const void *data, uint32_t size) {
-    const uint8_t *ptr = (const uint8_t *)data;
-    uint16_t crc = 0xffff;
-    while (size--) {
-        uint8_t data = *ptr++;
-        uint8_t x = (crc >> 8) ^ data;
-        x ^= x >> 4;
-        crc = (crc << 8) ^ (x << 12) ^ (x << 5) ^ x;
-    }
-    return crc;
-}
-
-void jd_compute_crc(jd_frame_t *frame) {
-    frame->crc = jd_crc16((uint8_t *)frame + 2, JD_FRAME_SIZE(frame) - 2);
-}
-
 int jd_shift_frame(jd_frame_t *frame) {
     int psize = frame->size;
     jd_packet_t *pkt = (jd_packet_t *)frame;